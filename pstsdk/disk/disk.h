@@ -483,10 +483,12 @@ ushort compute_signature(const block_reference<T>& reference) { return compute_s
 //! \brief Compute the CRC of a block of data
 //! \param[in] pdata A pointer to the block of data
 //! \param[in] cb The size of the data block
+//! \param[in] crc The CRC of any data preceding this block, to continue a 
+//!            computation over data which arrives in pieces
 //! \returns The computed CRC
 //! \sa [MS-PST] 5.3
 //! \ingroup utilityrelated
-ulong compute_crc(const void * pdata, ulong cb);
+ulong compute_crc(const void * pdata, ulong cb, ulong crc = 0);
 
 //! \brief Modifies the data block in place, according to the permute method
 //!
@@ -1229,7 +1231,7 @@ enum heap_client_signature
    heap_sig_smp = 0x8C,  //< Internal
    heap_sig_hmp = 0x9C,  //< Internal
    heap_sig_ch = 0xA5,   //< \deprecated Internal
-   heap_sig_chtc = 0xAC, //< \deprecated Internal
+   heap_sig_chtc = 0xAC, //< \deprecated GUST table context
    heap_sig_bth = 0xB5,  //< BTree on Heap
    heap_sig_pc = 0xBC,   //< Property Context
 };
@@ -1523,7 +1525,7 @@ struct tc_header
 //! \ingroup disk_tcrelated
 struct gust_header
 {
-    byte signature;
+    byte signature;             //$< GUST signature, \ref heap_sig_chtc
     byte unused1;
     ushort size_offsets[tc_offsets_max];
     heap_id row_btree_id;
@@ -1631,9 +1633,8 @@ inline pstsdk::ushort pstsdk::disk::compute_signature(T id, T address)
     return (ushort(ushort(value >> 16) ^ ushort(value)));
 }
 
-inline pstsdk::ulong pstsdk::disk::compute_crc(const void * pdata, ulong cb)
+inline pstsdk::ulong pstsdk::disk::compute_crc(const void * pdata, ulong cb, ulong crc)
 {
-    ulong crc = 0;
     const byte * pb = reinterpret_cast<const byte*>(pdata);
 
     while(cb-- > 0)
@@ -200,73 +200,93 @@ public:
     //! \brief Open a heap object on a node
     //! \param[in] n The node to open on top of. It will be copied.
     explicit heap(const node& n)
-        : m_pheap(new heap_impl(n)) { }
+        : m_pgroup(new alias_group(heap_ptr(new heap_impl(n)))) { }
     //! \brief Open a heap object on a node alias
     //! \param[in] n The node to alias
     heap(const node& n, alias_tag)
-        : m_pheap(new heap_impl(n, alias_tag())) { }
+        : m_pgroup(new alias_group(heap_ptr(new heap_impl(n, alias_tag())))) { }
     //! \brief Open a heap object on the specified node, and validate the client sig
     //! \throws sig_mismatch If the specified client_sig doesn't match what is in the node
     //! \param[in] n The node to open on top of. It will be copied.
     //! \param[in] client_sig Validate the heap has this value for the client sig
     heap(const node& n, byte client_sig)
-        : m_pheap(new heap_impl(n, client_sig)) { }
+        : m_pgroup(new alias_group(heap_ptr(new heap_impl(n, client_sig)))) { }
     //! \brief Open a heap object on the specified node (alias), and validate the client sig
     //! \throws sig_mismatch If the specified client_sig doesn't match what is in the node
     //! \param[in] n The node to alias
     //! \param[in] client_sig Validate the heap has this value for the client sig
     heap(const node& n, byte client_sig, alias_tag)
-        : m_pheap(new heap_impl(n, client_sig, alias_tag())) { }
+        : m_pgroup(new alias_group(heap_ptr(new heap_impl(n, client_sig, alias_tag())))) { }
     //! \brief Copy constructor
+    //!
+    //! The copy shares the heap_impl of other until the node of either is
+    //! requested for modification.
     //! \param[in] other The heap to copy
     heap(const heap& other)
-        : m_pheap(new heap_impl(*(other.m_pheap))) { }
+        : m_pgroup(new alias_group(other.m_pgroup->pheap, true)) { other.m_pgroup->shared = true; }
     //! \brief Alias constructor
+    //!
+    //! The alias and other move to a heap_impl of their own together, so 
+    //! modifications through either are always seen by the other.
     //! \param[in] other The heap to alias. The constructed object will share a heap_impl object with other.
     heap(const heap& other, alias_tag)
-        : m_pheap(other.m_pheap) { }
+        : m_pgroup(other.m_pgroup) { }
 
 #ifndef BOOST_NO_RVALUE_REFERENCES
     //! \brief Move constructor
     //! \param[in] other The heap to move from
     heap(heap&& other)
-        : m_pheap(std::move(other.m_pheap)) { }
+        : m_pgroup(std::move(other.m_pgroup)) { }
 #endif
 
     //! \copydoc heap_impl::size()
     size_t size(heap_id id) const
-        { return m_pheap->size(id); }
+        { return m_pgroup->pheap->size(id); }
     //! \copydoc heap_impl::get_root_id()
     heap_id get_root_id() const
-        { return m_pheap->get_root_id(); }
+        { return m_pgroup->pheap->get_root_id(); }
     //! \copydoc heap_impl::get_client_signature()
     byte get_client_signature() const
-        { return m_pheap->get_client_signature(); }
+        { return m_pgroup->pheap->get_client_signature(); }
     //! \copydoc heap_impl::read(std::vector<byte>&,heap_id,ulong) const
     size_t read(std::vector<byte>& buffer, heap_id id, ulong offset) const
-        { return m_pheap->read(buffer, id, offset); }
+        { return m_pgroup->pheap->read(buffer, id, offset); }
     //! \copydoc heap_impl::read(heap_id) const
     std::vector<byte> read(heap_id id) const
-        { return m_pheap->read(id); }
+        { return m_pgroup->pheap->read(id); }
     //! \copydoc heap_impl::open_stream()
     hid_stream_device open_stream(heap_id id)
-        { return m_pheap->open_stream(id); }
+        { return m_pgroup->pheap->open_stream(id); }
 
     //! \copydoc heap_impl::get_node() const
     const node& get_node() const
-        { return m_pheap->get_node(); }
+        { return m_pgroup->pheap->get_node(); }
     //! \copydoc heap_impl::get_node()    
+    //! \note If this heap shares its heap_impl with a copy, it first takes
+    //! a heap_impl (and node instance) of its own
     node& get_node()
-        { return m_pheap->get_node(); }
+        { detach(); return m_pgroup->pheap->get_node(); }
     
     //! \copydoc heap_impl::open_bth()
     template<typename K, typename V>
     std::tr1::shared_ptr<bth_node<K,V> > open_bth(heap_id root)
-        { return m_pheap->open_bth<K,V>(root); }
+        { return m_pgroup->pheap->open_bth<K,V>(root); }
 
 private:
     heap& operator=(const heap& other); // = delete
-    heap_ptr m_pheap;
+    //! \brief Stop sharing the heap_impl with any copies
+    void detach()
+        { if(m_pgroup->shared) { m_pgroup->pheap.reset(new heap_impl(*m_pgroup->pheap)); m_pgroup->shared = false; } }
+
+    //! \brief The state shared by a heap and all of its aliases
+    struct alias_group
+    {
+        explicit alias_group(const heap_ptr& p, bool s = false)
+            : pheap(p), shared(s) { }
+        heap_ptr pheap;
+        bool shared;    //!< True if pheap may also be held by a copy outside this group
+    };
+    std::tr1::shared_ptr<alias_group> m_pgroup;
 };
 
 //! \defgroup ltp_bthrelated BTH
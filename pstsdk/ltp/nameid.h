@@ -7,7 +7,13 @@
 #define PSTSDK_LTP_NAMEID_H
 
 #include <string>
+#include <vector>
 #include <algorithm>
+#if __GNUC__
+# include <tr1/unordered_map>
+#else
+# include <unordered_map>
+#endif
 
 #include "pstsdk/util/primitives.h"
 
@@ -70,6 +76,11 @@ private:
 //! 
 //! To use this class, one just constructs it with a store pointer
 //! and calls the various lookup overloads as needed.
+//!
+//! The entry, GUID and string streams are read into memory once, when
+//! the map is constructed, and indexed in both directions. Lookups by
+//! prop_id are an array access and lookups by named_prop a hash probe;
+//! neither touches the underlying file.
 //! \sa [MS-PST] 2.4.7
 //! \ingroup ltp_namedproprelated
 class name_id_map : private boost::noncopyable
@@ -77,10 +88,10 @@ class name_id_map : private boost::noncopyable
 public:
     //! \brief Construct a name_id_map for the given store
     //!
-    //! This will open the name_id_map node for the store
+    //! This will open the name_id_map node for the store, and read the 
+    //! whole mapping into memory.
     //! \param db The store to get the named property mapping for
-    name_id_map(const shared_db_ptr& db) 
-        : m_bag(db->lookup_node(nid_name_id_map)), m_buckets(m_bag.read_prop<slong>(0x1)), m_entry_stream(m_bag.open_prop_stream(0x3)), m_guid_stream(m_bag.open_prop_stream(0x2)), m_string_stream(m_bag.open_prop_stream(0x4)) { }
+    name_id_map(const shared_db_ptr& db);
 
     //! \brief Query if a given named prop exists
     //! \param[in] g The namespace guid for the named prop
@@ -104,7 +115,8 @@ public:
     bool prop_id_exists(prop_id id) const;
     //! \brief Get the total count of named property mappings in this store
     //! \returns The count of named property mappings in this store
-    size_t get_prop_count() const;
+    size_t get_prop_count() const
+        { return m_props.size(); }
 
     //! \brief Get all of the prop_ids which have a named_prop mapping in this store
     //! \returns a vector of prop_ids
@@ -137,29 +149,90 @@ public:
     named_prop lookup(prop_id id) const;
 
 private:
+    //! \brief Hashes a named_prop for the prop_id index
+    struct named_prop_hash
+    {
+        size_t operator()(const named_prop& p) const;
+    };
+    //! \brief Compares two named_props for the prop_id index
+    struct named_prop_equal
+    {
+        bool operator()(const named_prop& lhs, const named_prop& rhs) const;
+    };
+
     // helper functions
     named_prop construct(const disk::nameid& entry) const;
-    named_prop construct(ulong index) const;
     //! \brief Given a guid index into the GUID stream, return the namespace GUID
     //! \sa [MS-PST] 2.4.7.1/wGuid
     //! \param[in] guid_index The index into the guid stream
     //! \returns The namespace GUID
     guid read_guid(ushort guid_index) const;
-    ushort get_guid_index(const guid& g) const;
     std::wstring read_wstring(ulong string_offset) const;
-    ulong compute_hash_base(const named_prop& n) const; 
-    ulong compute_hash_value(ushort guid_index, const named_prop& n) const
-        { return (n.is_string() ? ((guid_index << 1) | 1) : (guid_index << 1)) ^ compute_hash_base(n); }
-    prop_id get_bucket_prop(ulong hash_value) const
-        { return static_cast<prop_id>((hash_value % m_buckets) + 0x1000); }
-
-    property_bag m_bag;                     //!< The property bag backing the named prop map
-    ulong m_buckets;                        //!< The number of buckets in the property bag, [NS-PST] 2.4.7.5
-    mutable prop_stream m_entry_stream;     //!< The entry stream, [MS-PST] 2.4.7.3
-    mutable prop_stream m_guid_stream;      //!< The guid stream, [MS-PST] 2.4.7.2
-    mutable prop_stream m_string_stream;    //!< The string stream, [MS-PST] 2.4.7.4
+
+    std::vector<byte> m_guid_stream;        //!< The guid stream, [MS-PST] 2.4.7.2
+    std::vector<byte> m_string_stream;      //!< The string stream, [MS-PST] 2.4.7.4
+    std::vector<prop_id> m_prop_list;       //!< The prop_id of each entry in the entry stream, [MS-PST] 2.4.7.3
+    std::vector<named_prop> m_props;        //!< The named_prop of each entry in the entry stream
+    std::tr1::unordered_map<named_prop, prop_id, named_prop_hash, named_prop_equal> m_ids; //!< prop_id of each named_prop
 };
 
+inline pstsdk::name_id_map::name_id_map(const shared_db_ptr& db)
+{
+    property_bag bag(db->lookup_node(nid_name_id_map));
+    std::vector<byte> entry_stream(bag.read_prop<std::vector<byte> >(0x3));
+
+    m_guid_stream = bag.read_prop<std::vector<byte> >(0x2);
+    m_string_stream = bag.read_prop<std::vector<byte> >(0x4);
+
+    size_t count = entry_stream.size() / sizeof(disk::nameid);
+    m_prop_list.reserve(count);
+    m_props.reserve(count);
+
+    for(size_t i = 0; i < count; ++i)
+    {
+        disk::nameid entry;
+        memcpy(&entry, &entry_stream[i * sizeof(entry)], sizeof(entry));
+
+        prop_id id = static_cast<prop_id>(disk::nameid_get_prop_index(entry) + 0x8000);
+        m_prop_list.push_back(id);
+        m_props.push_back(construct(entry));
+        m_ids.insert(std::make_pair(m_props.back(), id));
+    }
+}
+
+inline size_t pstsdk::name_id_map::named_prop_hash::operator()(const named_prop& p) const
+{
+    // FNV-1a over the guid and the name or id
+    size_t hash = 2166136261u;
+    const byte* pguid = reinterpret_cast<const byte*>(&p.get_guid());
+
+    for(size_t i = 0; i < sizeof(guid); ++i)
+        hash = (hash ^ pguid[i]) * 16777619u;
+
+    if(p.is_string())
+    {
+        for(size_t i = 0; i < p.get_name().size(); ++i)
+            hash = (hash ^ static_cast<size_t>(p.get_name()[i])) * 16777619u;
+    }
+    else
+    {
+        hash = (hash ^ static_cast<size_t>(p.get_id())) * 16777619u;
+    }
+
+    return hash;
+}
+
+inline bool pstsdk::name_id_map::named_prop_equal::operator()(const named_prop& lhs, const named_prop& rhs) const
+{
+    if(lhs.is_string() != rhs.is_string())
+        return false;
+
+    if(memcmp(&lhs.get_guid(), &rhs.get_guid(), sizeof(guid)) != 0)
+        return false;
+
+    return lhs.is_string() ? (lhs.get_name() == rhs.get_name()) : (lhs.get_id() == rhs.get_id());
+}
+
 inline pstsdk::named_prop pstsdk::name_id_map::construct(const disk::nameid& entry) const
 {
     if(nameid_is_string(entry))
@@ -168,14 +241,6 @@ inline pstsdk::named_prop pstsdk::name_id_map::construct(const disk::nameid& ent
         return named_prop(read_guid(disk::nameid_get_guid_index(entry)), entry.id);
 }
 
-inline pstsdk::named_prop pstsdk::name_id_map::construct(ulong index) const
-{
-    disk::nameid entry;
-    m_entry_stream.seekg(index * sizeof(disk::nameid), std::ios_base::beg);
-    m_entry_stream.read((char*)&entry, sizeof(entry));
-    return construct(entry);
-}
-
 inline pstsdk::guid pstsdk::name_id_map::read_guid(ushort guid_index) const
 {
     if(guid_index == 0)
@@ -185,61 +250,32 @@ inline pstsdk::guid pstsdk::name_id_map::read_guid(ushort guid_index) const
     if(guid_index == 2)
         return ps_public_strings;
 
+    size_t offset = (guid_index-3) * sizeof(guid);
+    if(offset + sizeof(guid) > m_guid_stream.size())
+        throw database_corrupt("read_guid: guid index out of range");
+
     guid g;
-    m_guid_stream.seekg((guid_index-3) * sizeof(guid), std::ios_base::beg);
-    m_guid_stream.read((char*)&g, sizeof(g));
+    memcpy(&g, &m_guid_stream[offset], sizeof(g));
     return g;
 }
 
-inline pstsdk::ushort pstsdk::name_id_map::get_guid_index(const guid& g) const
+inline std::wstring pstsdk::name_id_map::read_wstring(ulong string_offset) const
 {
-    if(memcmp(&g, &ps_none, sizeof(g)) == 0)
-        return 0;
-    if(memcmp(&g, &ps_mapi, sizeof(g)) == 0)
-        return 1;
-    if(memcmp(&g, &ps_public_strings, sizeof(g)) == 0)
-        return 2;
-
-    guid g_disk;
-    ushort num = 0;
-    m_guid_stream.seekg(0, std::ios_base::beg);
-    while(m_guid_stream.read((char*)&g_disk, sizeof(g_disk)))
-    {
-        if(memcmp(&g, &g_disk, sizeof(g)) == 0)
-            return num + 3;
-        ++num;
-    }
+    ulong size;
 
-    // didn't find it
-    m_guid_stream.clear();
-    throw key_not_found<guid>(g);
-}
+    if(static_cast<size_t>(string_offset) + sizeof(size) > m_string_stream.size())
+        throw database_corrupt("read_wstring: string offset out of range");
 
-inline std::wstring pstsdk::name_id_map::read_wstring(ulong string_offset) const
-{
-    m_string_stream.seekg(string_offset, std::ios_base::beg);
+    memcpy(&size, &m_string_stream[string_offset], sizeof(size));
 
-    ulong size;
-    m_string_stream.read((char*)&size, sizeof(size));
+    if(static_cast<size_t>(string_offset) + sizeof(size) + size > m_string_stream.size())
+        throw database_corrupt("read_wstring: string size out of range");
 
-    std::vector<byte> buffer(size);
-    m_string_stream.read(reinterpret_cast<char *>(&buffer[0]), size);
+    std::vector<byte> buffer(m_string_stream.begin() + string_offset + sizeof(size), m_string_stream.begin() + string_offset + sizeof(size) + size);
 
     return bytes_to_wstring(buffer);
 }
 
-inline pstsdk::ulong pstsdk::name_id_map::compute_hash_base(const named_prop& n) const {
-    if(n.is_string())
-    {
-        std::vector<byte> bytes(wstring_to_bytes(n.get_name()));
-        return disk::compute_crc(&bytes[0], bytes.size());
-    }
-    else
-    {
-        return n.get_id();
-    }
-}
-
 inline bool pstsdk::name_id_map::named_prop_exists(const named_prop& p) const
 {
     try 
@@ -264,74 +300,25 @@ inline bool pstsdk::name_id_map::prop_id_exists(prop_id id) const
 
 inline std::vector<prop_id> pstsdk::name_id_map::get_prop_list() const
 {
-    disk::nameid entry;
-    std::vector<prop_id> props;
-
-    m_entry_stream.seekg(0, std::ios_base::beg);
-    while(m_entry_stream.read((char*)&entry, sizeof(entry)) != 0)
-        props.push_back(nameid_get_prop_index(entry) + 0x8000);
-
-    m_entry_stream.clear();
-
-    return props;
-}
-
-inline size_t pstsdk::name_id_map::get_prop_count() const
-{
-    m_entry_stream.seekg(0, std::ios_base::end);
-
-    return static_cast<size_t>(m_entry_stream.tellg()) / sizeof(disk::nameid);
+    return m_prop_list;
 }
 
 inline pstsdk::prop_id pstsdk::name_id_map::lookup(const named_prop& p) const
 {
-    ushort guid_index;
-    
-    try
-    {
-        guid_index = get_guid_index(p.get_guid());
-    }
-    catch(key_not_found<guid>&)
-    {
-        throw key_not_found<named_prop>(p);
-    }
-
     // special handling of ps_mapi
-    if(guid_index == 1)
+    if(memcmp(&p.get_guid(), &ps_mapi, sizeof(guid)) == 0)
     {
         if(p.is_string()) throw key_not_found<named_prop>(p);
         if(p.get_id() >= 0x8000) throw key_not_found<named_prop>(p);
         return static_cast<prop_id>(p.get_id());
     }
 
-    ulong hash_value = compute_hash_value(guid_index, p);
-    ulong hash_base = compute_hash_base(p);
+    std::tr1::unordered_map<named_prop, prop_id, named_prop_hash, named_prop_equal>::const_iterator iter = m_ids.find(p);
 
-    if(!m_bag.prop_exists(get_bucket_prop(hash_value)))
+    if(iter == m_ids.end())
         throw key_not_found<named_prop>(p);
 
-    prop_stream bucket(const_cast<name_id_map*>(this)->m_bag.open_prop_stream(get_bucket_prop(hash_value)));
-    disk::nameid_hash_entry entry;
-    while(bucket.read((char*)&entry, sizeof(entry)) != 0)
-    {
-        if( (entry.hash_base == hash_base) &&
-            (disk::nameid_is_string(entry) == p.is_string()) &&
-            (disk::nameid_get_guid_index(entry) == guid_index)
-        )
-        {
-            // just double check the string..
-            if(p.is_string())
-            {
-                if(construct(disk::nameid_get_prop_index(entry)).get_name() != p.get_name())
-                    continue;
-            }
-
-            // found it!
-            return disk::nameid_get_prop_index(entry) + 0x8000;
-        }
-    }
-
-    throw key_not_found<named_prop>(p);
+    return iter->second;
 }
 
 inline pstsdk::named_prop pstsdk::name_id_map::lookup(prop_id id) const
@@ -341,10 +328,10 @@ inline pstsdk::named_prop pstsdk::name_id_map::lookup(prop_id id) const
 
     ulong index = id - 0x8000;
 
-    if(index > get_prop_count())
+    if(index >= get_prop_count())
         throw key_not_found<prop_id>(id);
 
-    return construct(index);
+    return m_props[index];
 }
 
 } // end namespace pstsdk
@@ -138,6 +138,26 @@ public:
     template<typename T>
     std::vector<T> read_prop_array(prop_id id) const;
 
+    //! \brief Read a string property as UTF-8
+    //!
+    //! Unicode string properties are transcoded straight from their stored
+    //! UTF-16LE form, without going through std::wstring. 8 bit string 
+    //! properties are widened byte by byte, as read_prop<std::wstring> does.
+    //! \param[in] id The prop_id
+    //! \throws key_not_found<prop_id> If the specified property is not present
+    //! \throws std::invalid_argument If the property is not a string
+    //! \returns The property value, as UTF-8
+    std::string read_prop_utf8(prop_id id) const
+        { std::string out; read_prop_utf8(id, out); return out; }
+    //! \brief Read a string property as UTF-8 into a caller supplied string
+    //!
+    //! Reusing the same string across calls avoids an allocation per call.
+    //! \param[in] id The prop_id
+    //! \param[out] out Receives the property value, replacing its contents
+    //! \throws key_not_found<prop_id> If the specified property is not present
+    //! \throws std::invalid_argument If the property is not a string
+    void read_prop_utf8(prop_id id, std::string& out) const;
+
     //! \brief Creates a stream device over a property on this object
     //!
     //! The returned stream device can be used to construct a proper stream:
@@ -331,11 +351,9 @@ inline std::wstring const_property_object::read_prop<std::wstring>(prop_id id) c
 {
     std::vector<byte> buffer = get_value_variable(id); 
 
+    // widen from the unsigned bytes, so 8 bit characters map to U+0080-U+00FF
     if(get_prop_type(id) == prop_type_string)
-    {
-        std::string s(buffer.begin(), buffer.end());
-        return std::wstring(s.begin(), s.end());
-    }
+        return std::wstring(buffer.begin(), buffer.end());
     else
     {
         return bytes_to_wstring(buffer);
@@ -352,8 +370,7 @@ inline std::vector<std::wstring> const_property_object::read_prop_array<std::wst
     {
         if(get_prop_type(id) == prop_type_mv_string)
         {
-            std::string s(buffer[i].begin(), buffer[i].end());
-            results.push_back(std::wstring(s.begin(), s.end()));
+            results.push_back(std::wstring(buffer[i].begin(), buffer[i].end()));
         }
         else
         {
@@ -384,6 +401,22 @@ inline std::string const_property_object::read_prop<std::string>(prop_id id) con
     }
 }
 
+inline void const_property_object::read_prop_utf8(prop_id id, std::string& out) const
+{
+    prop_type type = get_prop_type(id);
+
+    if(type != prop_type_string && type != prop_type_wstring)
+        throw std::invalid_argument("read_prop_utf8: not a string property");
+
+    std::vector<byte> buffer = get_value_variable(id);
+    const byte* pbytes = buffer.empty() ? 0 : &buffer[0];
+
+    if(type == prop_type_string)
+        latin1_to_utf8(pbytes, buffer.size(), out);
+    else
+        utf16le_to_utf8(pbytes, buffer.size(), out);
+}
+
 template<>
 inline std::vector<std::string> const_property_object::read_prop_array<std::string>(prop_id id) const
 {
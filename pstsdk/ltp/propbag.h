@@ -27,6 +27,25 @@ typedef bth_nonleaf_node<prop_id, disk::prop_entry> pc_bth_nonleaf_node;
 typedef bth_leaf_node<prop_id, disk::prop_entry> pc_bth_leaf_node;
 //@}
 
+//! \brief The value of a single property, as read by a projection
+//!
+//! Fixed size values are held directly in value. Variable length values
+//! are appended to a buffer supplied by the caller, and are described by
+//! offset and size into that buffer.
+//! \sa property_bag::read_projection
+//! \ingroup ltp_objectrelated
+struct projected_value
+{
+    prop_type type;     //!< The type of the property, or prop_type_unspecified if it does not exist
+    ulonglong value;    //!< The value of a fixed size property
+    size_t offset;      //!< Offset of a variable length value in the buffer
+    size_t size;        //!< Size of a variable length value in the buffer
+
+    //! \brief Check if the property was present
+    //! \returns true if the property exists
+    bool exists() const { return type != prop_type_unspecified; }
+};
+
 //! \brief Property Context (PC) Implementation
 //!
 //! A Property Context is simply a BTH where the BTH is stored as the client
@@ -35,6 +54,17 @@ typedef bth_leaf_node<prop_id, disk::prop_entry> pc_bth_leaf_node;
 //!
 //! const_property_object does most of the heavy lifting in terms of 
 //! property access and interpretation.
+//!
+//! Copies of a property_bag share the opened heap and BTH, so copying never
+//! re-reads them from disk. A copy only reopens them over a node instance
+//! of its own when the node is requested for modification, via the 
+//! non-const get_node().
+//!
+//! A property_bag can optionally be loaded into memory with load_all(). This
+//! walks the BTH once and copies every heap resident value into a single
+//! arena, after which property reads are answered by a binary search over
+//! a sorted prop_id array instead of a BTH traversal and heap read. Values
+//! stored in subnodes are still read on demand.
 //! \sa [MS-PST] 2.3.3
 //! \ingroup ltp_objectrelated
 class property_bag : public const_property_object
@@ -53,77 +83,222 @@ public:
     //! \param[in] h The heap to alias and interpret as a property_bag
     property_bag(const heap& h, alias_tag);
     //! \brief Copy construct a property_bag
+    //!
+    //! The copy shares the heap and BTH of other until either is modified.
     //! \param other The property bag to copy
-    property_bag(const property_bag& other);
+    property_bag(const property_bag& other)
+        : m_pgroup(new alias_group(other.m_pgroup->pbth, true)) { m_pgroup->psnapshot = other.m_pgroup->psnapshot; other.m_pgroup->shared = true; }
     //! \brief Alias a property_bag
+    //!
+    //! The alias and other move to a heap and BTH of their own together, so
+    //! modifications through either are always seen by the other.
     //! \param other The property bag to alias
-    property_bag(const property_bag& other, alias_tag);
+    property_bag(const property_bag& other, alias_tag)
+        : m_pgroup(other.m_pgroup) { }
 
 #ifndef BOOST_NO_RVALUE_REFERENCES
     //! \brief Move construct a property_bag
     //! \param other The property bag to move from
-    property_bag(property_bag&& other) : m_pbth(std::move(other.m_pbth)) { }
+    property_bag(property_bag&& other) : m_pgroup(std::move(other.m_pgroup)) { }
 #endif
 
     std::vector<prop_id> get_prop_list() const;
-    prop_type get_prop_type(prop_id id) const
-        { return (prop_type)m_pbth->lookup(id).type; }
+    prop_type get_prop_type(prop_id id) const;
     bool prop_exists(prop_id id) const;
     size_t size(prop_id id) const;
     hnid_stream_device open_prop_stream(prop_id id);
+
+    //! \brief Stream the value of a variable length property to a sink
+    //!
+    //! Values stored in a subnode are streamed a page at a time (see 
+    //! node::stream_to) rather than being read into memory in full.
+    //! \throws key_not_found<prop_id> If the specified property is not present
+    //! \param[in] id The property to stream
+    //! \param[in] sink Called with each run of data, in order
+    //! \returns The size of the property value
+    size_t stream_prop(prop_id id, const byte_sink& sink) const;
+
+    //! \brief Load all properties of this property_bag into memory
+    //!
+    //! Subsequent reads of any property are served from the in memory
+    //! snapshot, except for values stored in subnodes. Calling this on an
+    //! already loaded property_bag has no effect.
+    void load_all() const;
+    //! \brief Check if this property_bag has been loaded into memory
+    //! \returns true if load_all() has been called
+    bool is_loaded() const { return m_pgroup->psnapshot.get() != 0; }
+
+    //! \brief Read a fixed set of properties in one pass
+    //!
+    //! Only the requested properties are read. Properties which fit in 8 
+    //! bytes are returned directly in projected_value::value, all others are
+    //! appended to buffer. Requested properties which do not exist are 
+    //! returned with a type of prop_type_unspecified.
+    //! \param[in] ids The properties to read
+    //! \param[out] values One value per entry in ids, in the same order
+    //! \param[in,out] buffer Variable length values are appended to this buffer
+    void read_projection(const std::vector<prop_id>& ids, std::vector<projected_value>& values, std::vector<byte>& buffer) const;
     
     //! \brief Get the node underlying this property_bag
     //! \returns The node
-    const node& get_node() const { return m_pbth->get_node(); }
+    const node& get_node() const { return m_pgroup->pbth->get_node(); }
     //! \brief Get the node underlying this property_bag
+    //! \note If this property_bag shares its heap with a copy, it is first
+    //! reopened on a node of its own. Any in memory snapshot is discarded.
     //! \returns The node
-    node& get_node() { return m_pbth->get_node(); }
+    node& get_node() { detach(); m_pgroup->psnapshot.reset(); return m_pgroup->pbth->get_node(); }
 
 private:
     property_bag& operator=(const property_bag& other); // = delete
 
+    //! \brief An in memory copy of a property_bag, built by load_all()
+    struct snapshot
+    {
+        //! \brief A single property in the snapshot
+        struct entry
+        {
+            ushort type;    //!< The prop_type of this property
+            ulong value;    //!< The raw value or hnid, as stored in the BTH
+            size_t offset;  //!< Offset of the value in the arena
+            size_t size;    //!< Size of the value in the arena
+            bool in_arena;  //!< True if the value was copied into the arena
+        };
+
+        std::vector<prop_id> ids;       //!< All prop_ids in the bag, sorted
+        std::vector<entry> entries;     //!< Entries, parallel to ids
+        std::vector<byte> arena;        //!< Storage for heap resident values
+    };
+
+    //! \brief Stop sharing the heap and BTH with any copies
+    void detach();
+
+    //! \brief Check if a property of this type is stored directly in the BTH
+    //! \param[in] type The prop_type
+    //! \returns true if values of this type are not stored in the heap or a subnode
+    static bool is_inline_type(ushort type);
+    //! \brief Check if a property of this type is exactly 8 bytes
+    //! \param[in] type The prop_type
+    //! \returns true if values of this type are 8 bytes
+    static bool is_8_byte_type(ushort type);
+
+    //! \brief Find a property in the snapshot
+    //! \pre is_loaded()
+    //! \throws key_not_found<prop_id> If the property does not exist
+    const snapshot::entry& find_entry(prop_id id) const;
+    //! \brief Get the raw value of a property as stored in the BTH
+    //! \throws key_not_found<prop_id> If the property does not exist
+    ulong get_raw_value(prop_id id) const
+        { return m_pgroup->psnapshot ? find_entry(id).value : m_pgroup->pbth->lookup(id).id; }
+
     byte get_value_1(prop_id id) const
-        { return (byte)m_pbth->lookup(id).id; }
+        { return (byte)get_raw_value(id); }
     ushort get_value_2(prop_id id) const
-        { return (ushort)m_pbth->lookup(id).id; }
+        { return (ushort)get_raw_value(id); }
     ulong get_value_4(prop_id id) const
-        { return (ulong)m_pbth->lookup(id).id; }
+        { return (ulong)get_raw_value(id); }
     ulonglong get_value_8(prop_id id) const;
     std::vector<byte> get_value_variable(prop_id id) const;
     void get_prop_list_impl(std::vector<prop_id>& proplist, const pc_bth_node* pbth_node) const;
+    void load_all_impl(snapshot& snap, const pc_bth_node* pbth_node) const;
 
-    std::tr1::shared_ptr<pc_bth_node> m_pbth;
+    //! \brief The state shared by a property_bag and all of its aliases
+    struct alias_group
+    {
+        explicit alias_group(const std::tr1::shared_ptr<pc_bth_node>& p = std::tr1::shared_ptr<pc_bth_node>(), bool s = false)
+            : pbth(p), shared(s) { }
+        std::tr1::shared_ptr<pc_bth_node> pbth;
+        std::tr1::shared_ptr<const snapshot> psnapshot; //!< Loaded properties, if load_all() was called
+        bool shared;    //!< True if pbth may also be held by a copy outside this group
+    };
+    std::tr1::shared_ptr<alias_group> m_pgroup;
+};
+
+//! \brief A columnar batch of projected properties
+//!
+//! Collects the same set of properties from many property bags. Each
+//! requested property forms a column, each appended property bag a row. 
+//! Variable length values from all rows share a single buffer.
+//! \sa property_bag::read_projection
+//! \ingroup ltp_objectrelated
+class projection_batch
+{
+public:
+    //! \brief Construct an empty batch
+    //! \param[in] ids The properties to read from each property bag
+    explicit projection_batch(const std::vector<prop_id>& ids)
+        : m_ids(ids), m_columns(ids.size()), m_rows(0) { }
+
+    //! \brief Read the requested properties of a property bag as a new row
+    //! \param[in] bag The property bag to read from
+    void append(const property_bag& bag);
+    //! \brief Remove all rows from this batch
+    void clear();
+
+    //! \brief Get the number of rows in this batch
+    //! \returns The number of property bags appended
+    size_t rows() const { return m_rows; }
+    //! \brief Get the number of columns in this batch
+    //! \returns The number of requested properties
+    size_t columns() const { return m_ids.size(); }
+    //! \brief Get the properties requested by this batch
+    //! \returns The prop_id of each column
+    const std::vector<prop_id>& get_prop_ids() const { return m_ids; }
+    //! \brief Get all values of a column
+    //! \param[in] column The column index
+    //! \returns One value per row
+    const std::vector<projected_value>& get_column(size_t column) const { return m_columns[column]; }
+    //! \brief Get a single value
+    //! \param[in] row The row index
+    //! \param[in] column The column index
+    //! \returns The value
+    const projected_value& get(size_t row, size_t column) const { return m_columns[column][row]; }
+    //! \brief Get the data of a variable length value
+    //! \param[in] v A value from this batch
+    //! \returns A pointer to v.size bytes of data, or 0 if v.size is zero
+    const byte* get_data(const projected_value& v) const { return v.size ? &m_buffer[v.offset] : 0; }
+
+private:
+    std::vector<prop_id> m_ids;
+    std::vector<std::vector<projected_value> > m_columns;
+    std::vector<projected_value> m_row;     //!< Scratch space for the row being appended
+    std::vector<byte> m_buffer;             //!< Variable length values of all rows
+    size_t m_rows;
 };
 
 } // end pstsdk namespace
 
 inline pstsdk::property_bag::property_bag(const pstsdk::node& n)
+: m_pgroup(new alias_group)
 {
     heap h(n, disk::heap_sig_pc);
 
-    m_pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
+    m_pgroup->pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
 }
 
 inline pstsdk::property_bag::property_bag(const pstsdk::node& n, alias_tag)
+: m_pgroup(new alias_group)
 {
     heap h(n, disk::heap_sig_pc, alias_tag());
 
-    m_pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
+    m_pgroup->pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
 }
 
 inline pstsdk::property_bag::property_bag(const pstsdk::heap& h)
+: m_pgroup(new alias_group(std::tr1::shared_ptr<pc_bth_node>(), true))
 {
 #ifdef PSTSDK_VALIDATION_LEVEL_WEAK
     if(h.get_client_signature() != disk::heap_sig_pc)
         throw sig_mismatch("expected heap_sig_pc", 0, h.get_node().get_id(), h.get_client_signature(), disk::heap_sig_pc);
 #endif
 
+    // my_heap shares h's heap_impl until this bag is modified
     heap my_heap(h);
 
-    m_pbth = my_heap.open_bth<prop_id, disk::prop_entry>(my_heap.get_root_id());
+    m_pgroup->pbth = my_heap.open_bth<prop_id, disk::prop_entry>(my_heap.get_root_id());
 }
 
 inline pstsdk::property_bag::property_bag(const pstsdk::heap& h, alias_tag)
+: m_pgroup(new alias_group)
 {
 #ifdef PSTSDK_VALIDATION_LEVEL_WEAK
     if(h.get_client_signature() != disk::heap_sig_pc)
@@ -132,28 +307,28 @@ inline pstsdk::property_bag::property_bag(const pstsdk::heap& h, alias_tag)
 
     heap my_heap(h, alias_tag());
 
-    m_pbth = my_heap.open_bth<prop_id, disk::prop_entry>(my_heap.get_root_id());
+    m_pgroup->pbth = my_heap.open_bth<prop_id, disk::prop_entry>(my_heap.get_root_id());
 }
 
-inline pstsdk::property_bag::property_bag(const property_bag& other)
+inline void pstsdk::property_bag::detach()
 {
-    heap h(other.m_pbth->get_node());
-
-    m_pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
-}
-
-inline pstsdk::property_bag::property_bag(const property_bag& other, alias_tag)
-{
-    heap h(other.m_pbth->get_node(), alias_tag());
+    if(m_pgroup->shared)
+    {
+        heap h(m_pgroup->pbth->get_node());
 
-    m_pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
+        m_pgroup->pbth = h.open_bth<prop_id, disk::prop_entry>(h.get_root_id());
+        m_pgroup->shared = false;
+    }
 }
 
 inline std::vector<pstsdk::prop_id> pstsdk::property_bag::get_prop_list() const
 {
+    if(m_pgroup->psnapshot)
+        return m_pgroup->psnapshot->ids;
+
     std::vector<prop_id> proplist;
 
-    get_prop_list_impl(proplist, m_pbth.get());
+    get_prop_list_impl(proplist, m_pgroup->pbth.get());
 
     return proplist;
 }
@@ -177,11 +352,213 @@ inline void pstsdk::property_bag::get_prop_list_impl(std::vector<prop_id>& propl
     }
 }
 
+inline void pstsdk::property_bag::load_all() const
+{
+    if(m_pgroup->psnapshot)
+        return;
+
+    std::tr1::shared_ptr<snapshot> psnap(new snapshot);
+
+    load_all_impl(*psnap, m_pgroup->pbth.get());
+
+    m_pgroup->psnapshot = psnap;
+}
+
+inline void pstsdk::property_bag::load_all_impl(snapshot& snap, const pc_bth_node* pbth_node) const
+{
+    if(pbth_node->get_level() == 0)
+    {
+        // leaf
+        const pc_bth_leaf_node* pleaf = static_cast<const pc_bth_leaf_node*>(pbth_node);
+
+        for(uint i = 0; i < pleaf->num_values(); ++i)
+        {
+            const disk::prop_entry& prop = pleaf->get_value(i);
+            snapshot::entry e = { prop.type, prop.id, 0, 0, false };
+
+            if(!is_inline_type(prop.type) && is_heap_id(prop.id))
+            {
+                std::vector<byte> value = m_pgroup->pbth->get_heap_ptr()->read(prop.id);
+                e.offset = snap.arena.size();
+                e.size = value.size();
+                e.in_arena = true;
+                snap.arena.insert(snap.arena.end(), value.begin(), value.end());
+            }
+
+            // keys are stored in ascending order in the BTH
+            snap.ids.push_back(pleaf->get_key(i));
+            snap.entries.push_back(e);
+        }
+    }
+    else
+    {
+        // non-leaf
+        const pc_bth_nonleaf_node* pnonleaf = static_cast<const pc_bth_nonleaf_node*>(pbth_node); 
+        for(uint i = 0; i < pnonleaf->num_values(); ++i)
+            load_all_impl(snap, pnonleaf->get_child(i));
+    }
+}
+
+inline bool pstsdk::property_bag::is_inline_type(ushort type)
+{
+    switch(type)
+    {
+    case prop_type_null:
+    case prop_type_short:
+    case prop_type_long:
+    case prop_type_float:
+    case prop_type_error:
+    case prop_type_boolean:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline bool pstsdk::property_bag::is_8_byte_type(ushort type)
+{
+    switch(type)
+    {
+    case prop_type_double:
+    case prop_type_currency:
+    case prop_type_apptime:
+    case prop_type_longlong:
+    case prop_type_systime:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline void pstsdk::property_bag::read_projection(const std::vector<prop_id>& ids, std::vector<projected_value>& values, std::vector<byte>& buffer) const
+{
+    std::vector<byte> scratch;
+
+    values.resize(ids.size());
+
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        projected_value& v = values[i];
+        v.type = prop_type_unspecified;
+        v.value = 0;
+        v.offset = buffer.size();
+        v.size = 0;
+
+        ulong raw;
+        if(m_pgroup->psnapshot)
+        {
+            std::vector<prop_id>::const_iterator iter = std::lower_bound(m_pgroup->psnapshot->ids.begin(), m_pgroup->psnapshot->ids.end(), ids[i]);
+            if(iter == m_pgroup->psnapshot->ids.end() || *iter != ids[i])
+                continue;
+
+            const snapshot::entry& e = m_pgroup->psnapshot->entries[iter - m_pgroup->psnapshot->ids.begin()];
+            v.type = (prop_type)e.type;
+            raw = e.value;
+
+            if(e.in_arena)
+            {
+                const byte* pdata = e.size ? &m_pgroup->psnapshot->arena[e.offset] : 0;
+                if(is_8_byte_type(e.type) && e.size >= sizeof(ulonglong))
+                {
+                    memcpy(&v.value, pdata, sizeof(ulonglong));
+                }
+                else
+                {
+                    buffer.insert(buffer.end(), pdata, pdata + e.size);
+                    v.size = e.size;
+                }
+                continue;
+            }
+        }
+        else
+        {
+            try
+            {
+                disk::prop_entry prop = m_pgroup->pbth->lookup(ids[i]);
+                v.type = (prop_type)prop.type;
+                raw = prop.id;
+            }
+            catch(key_not_found<prop_id>&)
+            {
+                continue;
+            }
+        }
+
+        if(is_inline_type(v.type))
+        {
+            v.value = raw;
+            continue;
+        }
+
+        if(is_subnode_id(raw))
+        {
+            node sub(m_pgroup->pbth->get_node().lookup(raw));
+            scratch.resize(sub.size());
+            sub.read(scratch, 0);
+        }
+        else
+        {
+            scratch.resize(m_pgroup->pbth->get_heap_ptr()->size(raw));
+            m_pgroup->pbth->get_heap_ptr()->read(scratch, raw, 0);
+        }
+
+        if(is_8_byte_type(v.type) && scratch.size() >= sizeof(ulonglong))
+        {
+            memcpy(&v.value, &scratch[0], sizeof(ulonglong));
+        }
+        else
+        {
+            buffer.insert(buffer.end(), scratch.begin(), scratch.end());
+            v.size = scratch.size();
+        }
+    }
+}
+
+inline void pstsdk::projection_batch::append(const property_bag& bag)
+{
+    bag.read_projection(m_ids, m_row, m_buffer);
+
+    for(size_t i = 0; i < m_row.size(); ++i)
+        m_columns[i].push_back(m_row[i]);
+
+    ++m_rows;
+}
+
+inline void pstsdk::projection_batch::clear()
+{
+    for(size_t i = 0; i < m_columns.size(); ++i)
+        m_columns[i].clear();
+
+    m_buffer.clear();
+    m_rows = 0;
+}
+
+inline const pstsdk::property_bag::snapshot::entry& pstsdk::property_bag::find_entry(prop_id id) const
+{
+    std::vector<prop_id>::const_iterator iter = std::lower_bound(m_pgroup->psnapshot->ids.begin(), m_pgroup->psnapshot->ids.end(), id);
+
+    if(iter == m_pgroup->psnapshot->ids.end() || *iter != id)
+        throw key_not_found<prop_id>(id);
+
+    return m_pgroup->psnapshot->entries[iter - m_pgroup->psnapshot->ids.begin()];
+}
+
+inline pstsdk::prop_type pstsdk::property_bag::get_prop_type(prop_id id) const
+{
+    if(m_pgroup->psnapshot)
+        return (prop_type)find_entry(id).type;
+
+    return (prop_type)m_pgroup->pbth->lookup(id).type;
+}
+
 inline bool pstsdk::property_bag::prop_exists(prop_id id) const
 {
+    if(m_pgroup->psnapshot)
+        return std::binary_search(m_pgroup->psnapshot->ids.begin(), m_pgroup->psnapshot->ids.end(), id);
+
     try
     {
-        (void)m_pbth->lookup(id);
+        (void)m_pgroup->pbth->lookup(id);
     }
     catch(key_not_found<prop_id>&)
     {
@@ -194,6 +571,13 @@ inline bool pstsdk::property_bag::prop_exists(prop_id id) const
 
 inline pstsdk::ulonglong pstsdk::property_bag::get_value_8(prop_id id) const
 {
+    if(m_pgroup->psnapshot)
+    {
+        const snapshot::entry& e = find_entry(id);
+        if(e.in_arena && e.size >= sizeof(ulonglong))
+            return *(const ulonglong*)&m_pgroup->psnapshot->arena[e.offset];
+    }
+
     std::vector<byte> buffer = get_value_variable(id);
 
     return *(ulonglong*)&buffer[0];
@@ -201,18 +585,25 @@ inline pstsdk::ulonglong pstsdk::property_bag::get_value_8(prop_id id) const
 
 inline std::vector<pstsdk::byte> pstsdk::property_bag::get_value_variable(prop_id id) const
 {
+    if(m_pgroup->psnapshot)
+    {
+        const snapshot::entry& e = find_entry(id);
+        if(e.in_arena)
+            return std::vector<byte>(m_pgroup->psnapshot->arena.begin() + e.offset, m_pgroup->psnapshot->arena.begin() + e.offset + e.size);
+    }
+
     heapnode_id h_id = (heapnode_id)get_value_4(id);
     std::vector<byte> buffer;
 
     if(is_subnode_id(h_id))
     {
-        node sub(m_pbth->get_node().lookup(h_id));
+        node sub(m_pgroup->pbth->get_node().lookup(h_id));
         buffer.resize(sub.size());
         sub.read(buffer, 0);
     }
     else
     {
-        buffer = m_pbth->get_heap_ptr()->read(h_id);
+        buffer = m_pgroup->pbth->get_heap_ptr()->read(h_id);
     }
 
     return buffer;
@@ -221,12 +612,44 @@ inline std::vector<pstsdk::byte> pstsdk::property_bag::get_value_variable(prop_i
 
 inline size_t pstsdk::property_bag::size(prop_id id) const
 {
+    if(m_pgroup->psnapshot)
+    {
+        const snapshot::entry& e = find_entry(id);
+        if(e.in_arena)
+            return e.size;
+    }
+
     heapnode_id h_id = (heapnode_id)get_value_4(id);
 
     if(is_subnode_id(h_id))
-        return node(m_pbth->get_node().lookup(h_id)).size();
+        return node(m_pgroup->pbth->get_node().lookup(h_id)).size();
     else
-        return m_pbth->get_heap_ptr()->size(h_id);
+        return m_pgroup->pbth->get_heap_ptr()->size(h_id);
+}
+
+inline size_t pstsdk::property_bag::stream_prop(prop_id id, const byte_sink& sink) const
+{
+    if(m_pgroup->psnapshot)
+    {
+        const snapshot::entry& e = find_entry(id);
+        if(e.in_arena)
+        {
+            if(e.size > 0)
+                sink(&m_pgroup->psnapshot->arena[e.offset], e.size);
+            return e.size;
+        }
+    }
+
+    heapnode_id h_id = (heapnode_id)get_value_4(id);
+
+    if(is_subnode_id(h_id))
+        return node(m_pgroup->pbth->get_node().lookup(h_id)).stream_to(sink);
+
+    std::vector<byte> buffer = m_pgroup->pbth->get_heap_ptr()->read(h_id);
+    if(!buffer.empty())
+        sink(&buffer[0], buffer.size());
+
+    return buffer.size();
 }
 
 inline pstsdk::hnid_stream_device pstsdk::property_bag::open_prop_stream(prop_id id)
@@ -234,11 +657,11 @@ inline pstsdk::hnid_stream_device pstsdk::property_bag::open_prop_stream(prop_id
     heapnode_id h_id = (heapnode_id)get_value_4(id);
 
     if(h_id == 0)
-        return m_pbth->get_heap_ptr()->open_stream(h_id);
+        return m_pgroup->pbth->get_heap_ptr()->open_stream(h_id);
 
     if(is_subnode_id(h_id))
-        return m_pbth->get_node().lookup(h_id).open_as_stream();
+        return m_pgroup->pbth->get_node().lookup(h_id).open_as_stream();
     else
-        return m_pbth->get_heap_ptr()->open_stream(h_id);
+        return m_pgroup->pbth->get_heap_ptr()->open_stream(h_id);
 }
 #endif
@@ -7,6 +7,7 @@
 #define PSTSDK_LTP_TABLE_H
 
 #include <vector>
+#include <algorithm>
 #if __GNUC__
 # include <tr1/unordered_map>
 #else
@@ -29,6 +30,9 @@ class table_impl;
 //@{
 typedef std::tr1::shared_ptr<table_impl> table_ptr;
 typedef std::tr1::shared_ptr<const table_impl> const_table_ptr;
+
+//! \brief Maximum number of row matrix pages read ahead of the executor by a parallel scan
+const size_t table_scan_pages_in_flight = 64;
 //@}
 
 //! \brief Open the specified node as a table
@@ -123,6 +127,260 @@ private:
     const_table_ptr m_table;
 };
 
+//! \brief The iterator type exposed by the table for iteration over a sorted view
+//!
+//! Like \ref const_table_row_iter, this is a random access proxy iterator 
+//! producing const_table_row objects. Rather than walking the table in 
+//! row matrix order, it walks a permutation of the row offsets.
+//! \sa table_impl::get_sort_order
+//! \ingroup ltp_objectrelated
+class const_table_view_iter : public boost::iterator_facade<const_table_view_iter, const_table_row, boost::random_access_traversal_tag, const_table_row>
+{
+public:
+    //! \brief Default constructor
+    const_table_view_iter()
+        : m_position(0) { }
+
+    //! \brief Construct an iterator from a position, permutation and table
+    //! \param[in] pos The offset into the permutation
+    //! \param[in] order The permutation of row offsets
+    //! \param[in] table The table
+    const_table_view_iter(ulong pos, const std::tr1::shared_ptr<const std::vector<ulong> >& order, const const_table_ptr& table) 
+        : m_position(pos), m_order(order), m_table(table)  { }
+
+    //! \brief Get the offset into the table of the current row
+    //! \returns The row offset
+    ulong get_row() const { return (*m_order)[m_position]; }
+
+private:
+    friend class boost::iterator_core_access;
+
+    void increment() { ++m_position; }
+    bool equal(const const_table_view_iter& other) const
+        { return ((m_position == other.m_position) && (m_order == other.m_order)); }
+    const_table_row dereference() const
+        { return const_table_row((*m_order)[m_position], m_table); }
+    void decrement() { --m_position; }
+    void advance(int off) { m_position += off; }
+    size_t distance_to(const const_table_view_iter& other) const
+        { return (other.m_position - m_position); }
+
+    ulong m_position;
+    std::tr1::shared_ptr<const std::vector<ulong> > m_order;
+    const_table_ptr m_table;
+};
+
+//! \brief A range of table rows decoded by column
+//!
+//! A column_batch holds the cells of a fixed set of columns over a range
+//! of rows, stored one array per column rather than one object per row.
+//! Each column also has a validity bitmap, with one bit per row which is
+//! set if the cell exists on that row. The bitmaps use the same bit order
+//! as the cell existance bitmap on disk, so they can be tested with 
+//! \ref test_bit.
+//!
+//! Cells are stored as they are in the row matrix; for variable length
+//! properties that is the heapnode_id of the value. A batch filled by
+//! table_impl::read_exists holds only the row ids and validity bitmaps.
+//! \sa table_impl::read_columns
+//! \ingroup ltp_objectrelated
+class column_batch
+{
+public:
+    //! \brief Construct an empty batch
+    column_batch()
+        : m_start(0), m_rows(0) { }
+
+    //! \brief Get the offset into the table of the first row in this batch
+    //! \returns The offset of the first row
+    ulong get_start_row() const { return m_start; }
+    //! \brief Get the number of rows in this batch
+    //! \returns The number of rows
+    size_t rows() const { return m_rows; }
+    //! \brief Get the number of columns in this batch
+    //! \returns The number of columns
+    size_t columns() const { return m_ids.size(); }
+    //! \brief Get the properties of the columns in this batch
+    //! \returns The prop_id of each column
+    const std::vector<prop_id>& get_prop_ids() const { return m_ids; }
+    //! \brief Get the row_id of every row in this batch
+    //! \returns One row_id per row
+    const std::vector<row_id>& get_row_ids() const { return m_row_ids; }
+    //! \brief Get all cells of a column
+    //! \param[in] column The column index
+    //! \returns One value per row, zero where the cell does not exist
+    const std::vector<ulonglong>& get_values(size_t column) const { return m_values[column]; }
+    //! \brief Get the validity bitmap of a column
+    //! \param[in] column The column index
+    //! \returns One bit per row, set if the cell exists
+    const std::vector<byte>& get_validity(size_t column) const { return m_validity[column]; }
+    //! \brief Check to see if a cell exists
+    //! \param[in] row The row index in this batch
+    //! \param[in] column The column index
+    //! \returns true if the cell exists
+    bool is_valid(size_t row, size_t column) const
+        { return (m_validity[column][row >> 3] & (0x80 >> (row & 7))) != 0; }
+    //! \brief Count the cells which exist in a column
+    //! \param[in] column The column index
+    //! \returns The number of rows on which the cell exists
+    size_t count_valid(size_t column) const
+        { return m_validity[column].empty() ? 0 : count_bits(&m_validity[column][0], m_validity[column].size()); }
+    //! \brief Get the value of a cell
+    //! \param[in] row The row index in this batch
+    //! \param[in] column The column index
+    //! \returns The cell value, zero if the cell does not exist
+    ulonglong get_value(size_t row, size_t column) const
+        { return m_values[column][row]; }
+
+private:
+    template<typename T> friend class basic_table;
+
+    //! \brief Size this batch for a range of rows, with no valid cells
+    //! \param[in] start The offset of the first row
+    //! \param[in] count The number of rows
+    //! \param[in] ids The columns
+    //! \param[in] values true if cell values will be decoded
+    void reset(ulong start, size_t count, const std::vector<prop_id>& ids, bool values);
+
+    ulong m_start;
+    size_t m_rows;
+    std::vector<prop_id> m_ids;
+    std::vector<row_id> m_row_ids;
+    std::vector<std::vector<ulonglong> > m_values;
+    std::vector<std::vector<byte> > m_validity;
+};
+
+//! \brief A test against a single column of a table row
+//!
+//! Predicates are evaluated directly against the row matrix by
+//! table_impl::find_rows, without constructing any row objects. 
+//!
+//! Comparisons are made against the cell as it is stored in the row matrix.
+//! Cells of signed integer types are compared as signed values of the 
+//! width of the column, cells of floating point types as floating point 
+//! values (value then holds the bit pattern of a double, or for 
+//! prop_type_float that of a float in its low 4 bytes), and all others as 
+//! unsigned values. A comparison on a cell which does not exist is always false.
+//! \ingroup ltp_objectrelated
+class column_predicate
+{
+public:
+    //! \brief The test performed by a predicate
+    enum predicate_op
+    {
+        predicate_exists,           //!< The cell exists
+        predicate_not_exists,       //!< The cell does not exist
+        predicate_equal,            //!< cell == value
+        predicate_not_equal,        //!< cell != value
+        predicate_less,             //!< cell < value
+        predicate_less_equal,       //!< cell <= value
+        predicate_greater,          //!< cell > value
+        predicate_greater_equal,    //!< cell >= value
+        predicate_all_bits,         //!< (cell & value) == value
+        predicate_any_bits          //!< (cell & value) != 0
+    };
+
+    //! \brief Construct a predicate
+    //! \param[in] id The column to test
+    //! \param[in] op The test to perform
+    //! \param[in] value The value to compare against, or the mask for the bit tests
+    column_predicate(prop_id id, predicate_op op, ulonglong value = 0)
+        : m_id(id), m_op(op), m_value(value) { }
+
+    //! \brief Get the column this predicate tests
+    //! \returns The prop_id of the column
+    prop_id get_prop_id() const { return m_id; }
+    //! \brief Get the test this predicate performs
+    //! \returns The test
+    predicate_op get_op() const { return m_op; }
+    //! \brief Get the value this predicate compares against
+    //! \returns The value or mask
+    ulonglong get_value() const { return m_value; }
+
+    //! \brief Evaluate this predicate against a cell
+    //! \param[in] exists true if the cell exists
+    //! \param[in] cell The cell value, as returned by table_impl::get_cell_value
+    //! \param[in] type The type of the column
+    //! \param[in] size The width of the column
+    //! \returns true if the cell matches
+    bool matches(bool exists, ulonglong cell, ushort type, byte size) const;
+
+private:
+    prop_id m_id;
+    predicate_op m_op;
+    ulonglong m_value;
+};
+
+//! \brief Runs the jobs of a parallel table scan or store traversal
+//!
+//! Clients implement this interface over whatever thread pool they use.
+//! Jobs may be run on any thread and in any order. 
+//! \sa table_impl::parallel_scan, pst::for_each_message
+//! \ingroup ltp_objectrelated
+class scan_executor
+{
+public:
+    virtual ~scan_executor() { }
+    //! \brief Run a job, possibly on another thread
+    //! \param[in] job The job to run
+    virtual void submit(const std::tr1::function<void ()>& job) = 0;
+    //! \brief Wait until every submitted job has finished
+    virtual void wait() = 0;
+    //! \brief The number of workers this executor runs jobs on
+    //!
+    //! Callers may keep state per worker, such as a database handle, and
+    //! index it with current_worker().
+    //! \returns The number of workers
+    virtual size_t worker_count() const = 0;
+    //! \brief The worker running the calling job
+    //!
+    //! Only meaningful when called from within a job. No two jobs running at
+    //! the same time may see the same worker.
+    //! \returns A number less than worker_count()
+    virtual size_t current_worker() const = 0;
+};
+
+//! \brief A scan_executor which runs each job immediately, on the calling thread
+//! \ingroup ltp_objectrelated
+class sequential_executor : public scan_executor
+{
+public:
+    void submit(const std::tr1::function<void ()>& job) { job(); }
+    void wait() { }
+    size_t worker_count() const { return 1; }
+    size_t current_worker() const { return 0; }
+};
+
+//! \brief Waits for a scan_executor when it goes out of scope
+//!
+//! Jobs refer to state on the stack of the function which submitted them.
+//! This makes sure they have finished before that function returns, even
+//! if it throws after some jobs were submitted.
+//! \ingroup ltp_objectrelated
+class scan_wait_guard
+{
+public:
+    //! \brief Construct a guard for an executor
+    //! \param[in] executor The executor to wait for
+    explicit scan_wait_guard(scan_executor& executor) : m_executor(executor) { }
+    ~scan_wait_guard()
+    {
+        try
+        {
+            m_executor.wait();
+        }
+        catch(...)
+        {
+        }
+    }
+
+private:
+    scan_wait_guard(const scan_wait_guard&); // = delete
+    scan_wait_guard& operator=(const scan_wait_guard&); // = delete
+
+    scan_executor& m_executor;
+};
+
 //! \brief Table implementation
 //!
 //! Similar to the \ref node and \ref heap classes, the table class is divided
@@ -219,6 +477,141 @@ public:
     //! \param[in] id The prop_id
     //! \returns The vector.size() if read_prop were called
     virtual size_t row_prop_size(ulong row, prop_id id) const = 0;
+    //! \brief Decode a range of rows into a column_batch
+    //!
+    //! The row matrix is read one page at a time, and each page only once.
+    //! Columns which are not present in this table are returned with no
+    //! valid cells.
+    //! \throws out_of_range If start + count is beyond the size of this table
+    //! \param[in] start The offset into the table of the first row to decode
+    //! \param[in] count The number of rows to decode
+    //! \param[in] ids The columns to decode
+    //! \param[out] batch The decoded rows
+    virtual void read_columns(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const = 0;
+    //! \brief Read which cells exist for a range of rows
+    //!
+    //! Like read_columns, but only the row ids and validity bitmaps are 
+    //! filled in; no cell values are decoded. Use column_batch::count_valid
+    //! to gather column statistics.
+    //! \throws out_of_range If start + count is beyond the size of this table
+    //! \param[in] start The offset into the table of the first row
+    //! \param[in] count The number of rows
+    //! \param[in] ids The columns to check
+    //! \param[out] batch The existance bitmaps
+    virtual void read_exists(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const = 0;
+    //! \brief Get the properties which exist on a given row
+    //!
+    //! The cell existance bitmap of the row is read once for all columns.
+    //! \throws out_of_range If the specified row offset is beyond the size of this table
+    //! \param[in] row The offset into the table
+    //! \returns The prop_ids of all cells which exist on this row
+    virtual std::vector<prop_id> get_row_prop_list(ulong row) const = 0;
+    //! \brief Decode every row of this table, in parallel
+    //!
+    //! The table is split into ranges of rows along the pages of the row 
+    //! matrix, each of which is decoded by a separate job on executor into
+    //! a column_batch of its own and passed to process. process may be 
+    //! called concurrently, and in any order.
+    //!
+    //! The underlying file is not safe for concurrent access, so the row 
+    //! matrix pages are read on the calling thread, a limited number at a
+    //! time; only the decoding is run by the executor.
+    //! \param[in] ids The columns to decode
+    //! \param[in] process Called once with each decoded range of rows
+    //! \param[in] executor Runs the decode jobs
+    virtual void parallel_scan(const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process, scan_executor& executor) const = 0;
+    //! \brief Find the rows which match all of a set of predicates
+    //!
+    //! The predicates are evaluated directly against the row matrix, one
+    //! page at a time; no row objects are constructed.
+    //! \param[in] predicates The predicates a row must satisfy
+    //! \returns The offsets into the table of all matching rows, in order
+    virtual std::vector<ulong> find_rows(const std::vector<column_predicate>& predicates) const = 0;
+
+    //! \brief Get the rows of this table ordered by a column
+    //!
+    //! Fixed size columns are ordered by their value with a radix sort, 
+    //! variable length columns by comparing their contents byte by byte. 
+    //! Rows with equal values keep their table order, and rows where the 
+    //! cell does not exist come last. The order is built once and kept with
+    //! this table for later calls.
+    //! \throws key_not_found<prop_id> If the column is not present in this table
+    //! \param[in] id The column to order by
+    //! \param[in] descending true to order the largest value first
+    //! \returns The row offsets in order
+    std::tr1::shared_ptr<const std::vector<ulong> > get_sort_order(prop_id id, bool descending = false) const;
+    //! \brief Get an iterator to the first row ordered by a column
+    //! \copydetails get_sort_order()
+    //! \returns The requested iterator
+    const_table_view_iter sorted_begin(prop_id id, bool descending = false) const
+        { return const_table_view_iter(0, get_sort_order(id, descending), shared_from_this()); }
+    //! \brief Get an end iterator for rows ordered by a column
+    //! \param[in] id The column to order by
+    //! \param[in] descending true to order the largest value first
+    //! \returns The requested iterator
+    const_table_view_iter sorted_end(prop_id id, bool descending = false) const
+        { return const_table_view_iter(size(), get_sort_order(id, descending), shared_from_this()); }
+    //! \brief Find all rows with a given value in a fixed size column
+    //!
+    //! The first lookup on a column builds a hash index over it, which is
+    //! kept with this table for later lookups.
+    //! \throws key_not_found<prop_id> If the column is not present in this table
+    //! \throws invalid_argument If the column is variable length
+    //! \param[in] id The column to search
+    //! \param[in] value The cell value to find
+    //! \returns The offsets of all matching rows, in order
+    std::vector<ulong> find_rows_by_value(prop_id id, ulonglong value) const;
+    //! \brief Find all rows with a given value in a variable length column
+    //! \copydetails find_rows_by_value(prop_id,ulonglong) const
+    //! \throws invalid_argument If the column is fixed size
+    std::vector<ulong> find_rows_by_value(prop_id id, const std::vector<byte>& value) const;
+
+    //! \brief Discard all cached sort orders and column indexes
+    //!
+    //! Called whenever the node of this table is handed out for modification.
+    //! Orders already returned by get_sort_order are not affected.
+    void clear_views()
+        { m_sort_orders.clear(); m_indexes.clear(); }
+
+private:
+    typedef std::tr1::unordered_map<ulonglong, std::vector<ulong> > column_index;
+
+    //! \brief Build or fetch the hash index of a column
+    const column_index& get_column_index(prop_id id) const;
+    //! \brief Check if cells of a type are stored in the row matrix
+    //! \param[in] type The column type
+    //! \returns true if the cell holds the value rather than a heapnode_id
+    static bool is_fixed_size(prop_type type);
+    //! \brief Transform a cell so that unsigned order matches value order
+    //! \param[in] cell The cell value
+    //! \param[in] type The column type
+    //! \returns The sort key
+    static ulonglong sort_key(ulonglong cell, prop_type type);
+    //! \brief Hash the contents of a variable length cell
+    //! \param[in] value The cell contents
+    //! \returns The hash
+    static ulonglong hash_bytes(const std::vector<byte>& value);
+    //! \brief Stable LSD radix sort of rows by key
+    //! \param[in,out] keys The sort keys
+    //! \param[in,out] rows The row offsets, parallel to keys
+    static void radix_sort(std::vector<ulonglong>& keys, std::vector<ulong>& rows);
+
+    mutable std::tr1::unordered_map<ulong, std::tr1::shared_ptr<const std::vector<ulong> > > m_sort_orders; //!< Cached sort orders, by prop_id and direction
+    mutable std::tr1::unordered_map<prop_id, std::tr1::shared_ptr<const column_index> > m_indexes; //!< Cached hash indexes, by prop_id
+};
+
+//! \brief A column of a table, as kept in memory
+//!
+//! This holds the parts of \ref disk::column_description and 
+//! \ref disk::gust_column_description used to read a cell.
+//! \ingroup ltp_objectrelated
+struct table_column
+{
+    ushort type;        //!< Column property type
+    prop_id id;         //!< Column property id
+    ushort offset;      //!< Offset into the row
+    byte size;          //!< Width of the column
+    ushort bit_offset;  //!< Bit offset into the existance bitmap
 };
 
 //! \brief Implementation of an ANSI TC (64k rows) and a unicode TC
@@ -232,6 +625,12 @@ public:
 //! BTH header. We use that to determine what type of table this is, rather
 //! than trying to figure out if we're opened over an ANSI or Unicode PST
 //! (which has been abstracted away from us at this point).
+//!
+//! The same class also reads the GUST table, the table stored in
+//! \ref nid_all_message_search_contents. It differs from a TC only in its
+//! header, which keeps the column descriptions in a subnode so that the
+//! table can have more than 255 columns. The per column data_subnode of a
+//! GUST column description is not used.
 //! \tparam T The size of the value type in the row index BTH - ushort for an ANSI table, ulong for a Unicode table
 //! \sa [MS-PST] 2.3.4.3.1/dwRowIndex
 //! \ingroup ltp_objectrelated
@@ -253,6 +652,11 @@ public:
     size_t size() const;
     bool prop_exists(ulong row, prop_id id) const;
     size_t row_prop_size(ulong row, prop_id id) const;
+    void read_columns(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const;
+    void read_exists(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const;
+    std::vector<prop_id> get_row_prop_list(ulong row) const;
+    void parallel_scan(const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process, scan_executor& executor) const;
+    std::vector<ulong> find_rows(const std::vector<column_predicate>& predicates) const;
 
 private:
     friend table_ptr open_table(const node& n);
@@ -266,30 +670,85 @@ private:
     std::vector<byte> m_vec_rowarray;
     std::tr1::shared_ptr<node> m_pnode_rowarray;
 
-    std::tr1::unordered_map<prop_id, disk::column_description> m_columns; 
-    typedef std::tr1::unordered_map<prop_id, disk::column_description>::iterator column_iter;
-    typedef std::tr1::unordered_map<prop_id, disk::column_description>::const_iterator const_column_iter;
+    std::vector<table_column> m_columns; //!< The column directory, sorted by prop_id
 
     ushort m_offsets[disk::tc_offsets_max];
 
+    ulong m_rows_per_page;  //!< Number of rows on each page of the row matrix, cached at open
+    ulong m_num_rows;       //!< Number of rows in the table, cached at open
+
     // helper functions
+    //! \brief Read the header of a TC
+    //! \param[in] h The heap of the table node
+    //! \param[in] n The table node
+    void init_tc(heap& h, const node& n);
+    //! \brief Read the header of a GUST table
+    //! \param[in] h The heap of the table node
+    //! \param[in] n The table node
+    void init_gust(heap& h, const node& n);
+    //! \brief Open the row matrix, sort the column directory and cache the row geometry
+    //! \param[in] h The heap of the table node
+    //! \param[in] n The table node
+    //! \param[in] row_matrix_id The heapnode_id of the row matrix
+    //! \param[in] size_offsets The row offset array, see \ref disk::tc_offsets
+    void init_rows(heap& h, const node& n, heapnode_id row_matrix_id, const ushort* size_offsets);
+    //! \brief Find a column in the column directory
+    //! \param[in] id The prop_id of the column
+    //! \returns The column description, or 0 if the column is not present
+    const table_column* find_column(prop_id id) const;
     //! \brief Calculate the number of bytes per row
     //! \returns The number of bytes for a single row
     ulong cb_per_row() const { return m_offsets[disk::tc_offsets_bitmap]; }
     //! \brief Get the offset of the CEB (cell existance bitmap)
     //! \returns The offset into a row of the CEB
     ulong exists_bitmap_start() const { return m_offsets[disk::tc_offsets_one]; }
-    //! \brief Calculate the number of rows per page (..external block)
+    //! \brief Get the number of rows per page (..external block)
     //! \returns The number of rows which fit on a single external block
-    ulong rows_per_page() const { return (m_pnode_rowarray ? m_pnode_rowarray->get_page_size(0) / cb_per_row() : m_vec_rowarray.size() / cb_per_row()); }
+    ulong rows_per_page() const { return m_rows_per_page; }
     //! \brief Read and interpret data from a row
     //! \tparam Val the type to read
     //! \param[in] row The row to read
     //! \param[in] offset The offset into the row
     template<typename Val> Val read_raw_row(ulong row, ushort offset) const;
-    //! \brief Read the CEB for a given row
-    //! \returns The CEB
-    std::vector<byte> read_exists_bitmap(ulong row) const;
+    //! \brief Get a pointer to consecutive rows in the row matrix
+    //! \pre All rows are on the same page of the row matrix
+    //! \param[in] row The first row
+    //! \param[in] count The number of rows
+    //! \param[out] buffer Used to hold the rows if they must be read from disk
+    //! \returns A pointer to the first row
+    const byte* read_rows(ulong row, ulong count, std::vector<byte>& buffer) const;
+    //! \brief Interpret the contents of a cell
+    //! \param[in] pcell Pointer to the cell in the row
+    //! \param[in] size The width of the column
+    //! \returns The cell value
+    static ulonglong decode_cell(const byte* pcell, byte size);
+    //! \brief Check if a cell exists, reading only its byte of the CEB
+    //! \param[in] row The row to check
+    //! \param[in] column The column to check
+    //! \returns true if the cell exists
+    bool cell_exists(ulong row, const table_column& column) const
+        { return (read_raw_row<byte>(row, static_cast<ushort>(exists_bitmap_start() + (column.bit_offset >> 3))) & (0x80 >> (column.bit_offset & 7))) != 0; }
+    //! \brief Decode a range of rows, with or without the cell values
+    void read_columns_impl(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch, bool values) const;
+    //! \brief Decode consecutive rows into a batch
+    //! \param[in] prow The first row to decode
+    //! \param[in] first The index in batch of the first row
+    //! \param[in] count The number of rows to decode
+    //! \param[in] columns The columns of batch
+    //! \param[in,out] batch The batch to decode into
+    //! \param[in] values true to decode the cell values
+    void decode_rows(const byte* prow, size_t first, size_t count, const std::vector<const table_column*>& columns, column_batch& batch, bool values) const;
+
+    //! \brief A single job of a parallel scan
+    struct scan_job
+    {
+        ulong start;                //!< Offset of the first row of this job
+        ulong count;                //!< Number of rows in this job
+        std::vector<byte> rows;     //!< The rows, if read from disk
+        column_batch batch;         //!< Decode buffer for this job
+    };
+    //! \brief Decode and process a single job of a parallel scan
+    void run_scan_job(const std::tr1::shared_ptr<scan_job>& job, const std::vector<const table_column*>& columns, const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process) const;
 };
 
 typedef basic_table<ushort> small_table;
@@ -305,6 +764,11 @@ typedef basic_table<ulong> large_table;
 //! objects, either via operator[] or the iterators. Most property access should
 //! go through the row objects. Other member functions allow for row and type
 //! lookup.
+//!
+//! Copies of a table share the underlying table implementation, so copying
+//! never re-reads the table from disk. A copy only takes its own instance
+//! when the node is requested for modification, via the non-const 
+//! get_node().
 //! \sa [MS-PST] 2.3.4
 //! \ingroup ltp_objectrelated
 class table
@@ -317,74 +781,120 @@ public:
     //! \param[in] n The node to alias and interpret as a table
     table(const node& n, alias_tag);
     //! \brief Copy constructor
+    //!
+    //! The copy shares the table implementation of other until either is
+    //! modified.
     //! \param[in] other The table to copy
-    table(const table& other);
+    table(const table& other)
+        : m_pgroup(new alias_group(other.m_pgroup->ptable, true)) { other.m_pgroup->shared = true; }
     //! \brief Alias constructor
+    //!
+    //! The alias and other move to a table implementation of their own 
+    //! together, so modifications through either are always seen by the other.
     //! \param[in] other The table to alias
     table(const table& other, alias_tag)
-        : m_ptable(other.m_ptable) { }
+        : m_pgroup(other.m_pgroup) { }
 
     //! \copydoc table_impl::operator[]()
     const_table_row operator[](ulong row) const
-        { return (*m_ptable)[row]; }
+        { return (*m_pgroup->ptable)[row]; }
     //! \copydoc table_impl::begin()
     const_table_row_iter begin() const
-        { return m_ptable->begin(); }
+        { return m_pgroup->ptable->begin(); }
     //! \copydoc table_impl::end()
     const_table_row_iter end() const
-        { return m_ptable->end(); }
+        { return m_pgroup->ptable->end(); }
 
     //! \copydoc table_impl::get_node()
+    //! \note If this table shares its implementation with a copy, it is
+    //! first reopened on a node of its own. Cached sort orders and column
+    //! indexes are discarded.
     node& get_node() 
-        { return m_ptable->get_node(); }
+        { detach(); m_pgroup->ptable->clear_views(); return m_pgroup->ptable->get_node(); }
     //! \copydoc table_impl::get_node() const
     const node& get_node() const
-        { return m_ptable->get_node(); }
+        { return m_pgroup->ptable->get_node(); }
     //! \copydoc table_impl::get_cell_value()
     ulonglong get_cell_value(ulong row, prop_id id) const
-        { return m_ptable->get_cell_value(row, id); }
+        { return m_pgroup->ptable->get_cell_value(row, id); }
     //! \copydoc table_impl::read_cell()
     std::vector<byte> read_cell(ulong row, prop_id id) const
-        { return m_ptable->read_cell(row, id); }
+        { return m_pgroup->ptable->read_cell(row, id); }
     //! \copydoc table_impl::open_cell_stream()
     hnid_stream_device open_cell_stream(ulong row, prop_id id)
-        { return m_ptable->open_cell_stream(row, id); }
+        { return m_pgroup->ptable->open_cell_stream(row, id); }
     //! \copydoc table_impl::get_prop_list()
     std::vector<prop_id> get_prop_list() const
-        { return m_ptable->get_prop_list(); }
+        { return m_pgroup->ptable->get_prop_list(); }
     //! \copydoc table_impl::get_prop_type()
     prop_type get_prop_type(prop_id id) const
-        { return m_ptable->get_prop_type(id); }
+        { return m_pgroup->ptable->get_prop_type(id); }
     //! \copydoc table_impl::get_row_id()
     row_id get_row_id(ulong row) const
-        { return m_ptable->get_row_id(row); }
+        { return m_pgroup->ptable->get_row_id(row); }
     //! \copydoc table_impl::lookup_row()
     ulong lookup_row(row_id id) const
-        { return m_ptable->lookup_row(id); }
+        { return m_pgroup->ptable->lookup_row(id); }
     //! \copydoc table_impl::size()
     size_t size() const
-        { return m_ptable->size(); }
+        { return m_pgroup->ptable->size(); }
+    //! \copydoc table_impl::read_columns()
+    void read_columns(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const
+        { m_pgroup->ptable->read_columns(start, count, ids, batch); }
+    //! \copydoc table_impl::read_exists()
+    void read_exists(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const
+        { m_pgroup->ptable->read_exists(start, count, ids, batch); }
+    //! \copydoc table_impl::parallel_scan()
+    void parallel_scan(const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process, scan_executor& executor) const
+        { m_pgroup->ptable->parallel_scan(ids, process, executor); }
+    //! \copydoc table_impl::find_rows()
+    std::vector<ulong> find_rows(const std::vector<column_predicate>& predicates) const
+        { return m_pgroup->ptable->find_rows(predicates); }
+    //! \copydoc table_impl::get_sort_order()
+    std::tr1::shared_ptr<const std::vector<ulong> > get_sort_order(prop_id id, bool descending = false) const
+        { return m_pgroup->ptable->get_sort_order(id, descending); }
+    //! \copydoc table_impl::sorted_begin()
+    const_table_view_iter sorted_begin(prop_id id, bool descending = false) const
+        { return m_pgroup->ptable->sorted_begin(id, descending); }
+    //! \copydoc table_impl::sorted_end()
+    const_table_view_iter sorted_end(prop_id id, bool descending = false) const
+        { return m_pgroup->ptable->sorted_end(id, descending); }
+    //! \copydoc table_impl::find_rows_by_value(prop_id,ulonglong) const
+    std::vector<ulong> find_rows_by_value(prop_id id, ulonglong value) const
+        { return m_pgroup->ptable->find_rows_by_value(id, value); }
+    //! \copydoc table_impl::find_rows_by_value(prop_id,const std::vector<byte>&) const
+    std::vector<ulong> find_rows_by_value(prop_id id, const std::vector<byte>& value) const
+        { return m_pgroup->ptable->find_rows_by_value(id, value); }
 private:
     table();
+    //! \brief Stop sharing the table implementation with any copies
+    void detach();
 
-    table_ptr m_ptable;
+    //! \brief The state shared by a table and all of its aliases
+    struct alias_group
+    {
+        explicit alias_group(const table_ptr& p, bool s = false)
+            : ptable(p), shared(s) { }
+        table_ptr ptable;
+        bool shared;    //!< True if ptable may also be held by a copy outside this group
+    };
+    std::tr1::shared_ptr<alias_group> m_pgroup;
 };
 
 } // end pstsdk namespace
 
 inline pstsdk::table_ptr pstsdk::open_table(const node& n)
 {
-    if(n.get_id() == nid_all_message_search_contents)
-    {
-        //return table_ptr(new gust(n));
-        throw not_implemented("gust table");
-    }
-
     heap h(n);
     std::vector<byte> table_info = h.read(h.get_root_id());
-    disk::tc_header* pheader = (disk::tc_header*)&table_info[0];
+    heap_id row_btree_id;
+
+    if(n.get_id() == nid_all_message_search_contents)
+        row_btree_id = ((disk::gust_header*)&table_info[0])->row_btree_id;
+    else
+        row_btree_id = ((disk::tc_header*)&table_info[0])->row_btree_id;
 
-    std::vector<byte> bth_info = h.read(pheader->row_btree_id);
+    std::vector<byte> bth_info = h.read(row_btree_id);
     disk::bth_header* pbthheader = (disk::bth_header*)&bth_info[0];
 
     if(pbthheader->entry_size == 4)
@@ -395,17 +905,16 @@ inline pstsdk::table_ptr pstsdk::open_table(const node& n)
 
 inline pstsdk::table_ptr pstsdk::open_table(const node& n, alias_tag)
 {
-    if(n.get_id() == nid_all_message_search_contents)
-    {
-        //return table_ptr(new gust(n));
-        throw not_implemented("gust table");
-    }
-
     heap h(n);
     std::vector<byte> table_info = h.read(h.get_root_id());
-    disk::tc_header* pheader = (disk::tc_header*)&table_info[0];
+    heap_id row_btree_id;
+
+    if(n.get_id() == nid_all_message_search_contents)
+        row_btree_id = ((disk::gust_header*)&table_info[0])->row_btree_id;
+    else
+        row_btree_id = ((disk::tc_header*)&table_info[0])->row_btree_id;
 
-    std::vector<byte> bth_info = h.read(pheader->row_btree_id);
+    std::vector<byte> bth_info = h.read(row_btree_id);
     disk::bth_header* pbthheader = (disk::bth_header*)&bth_info[0];
 
     if(pbthheader->entry_size == 4)
@@ -416,16 +925,7 @@ inline pstsdk::table_ptr pstsdk::open_table(const node& n, alias_tag)
 
 inline std::vector<pstsdk::prop_id> pstsdk::const_table_row::get_prop_list() const
 {
-    std::vector<prop_id> columns = m_table->get_prop_list();
-    std::vector<prop_id> props;
-
-    for(size_t i = 0; i < columns.size(); ++i)
-    {
-        if(prop_exists(columns[i]))
-            props.push_back(columns[i]);
-    }
-
-    return props;
+    return m_table->get_row_prop_list(m_position);
 }
 
 inline size_t pstsdk::const_table_row::size(prop_id id) const
@@ -481,8 +981,36 @@ inline pstsdk::hnid_stream_device pstsdk::const_table_row::open_prop_stream(prop
 template<typename T>
 inline pstsdk::basic_table<T>::basic_table(const node& n)
 {
-    heap h(n, disk::heap_sig_tc);
+    if(n.get_id() == nid_all_message_search_contents)
+    {
+        heap h(n, disk::heap_sig_chtc);
+        init_gust(h, n);
+    }
+    else
+    {
+        heap h(n, disk::heap_sig_tc);
+        init_tc(h, n);
+    }
+}
 
+template<typename T>
+inline pstsdk::basic_table<T>::basic_table(const node& n, alias_tag)
+{
+    if(n.get_id() == nid_all_message_search_contents)
+    {
+        heap h(n, disk::heap_sig_chtc, alias_tag());
+        init_gust(h, n);
+    }
+    else
+    {
+        heap h(n, disk::heap_sig_tc, alias_tag());
+        init_tc(h, n);
+    }
+}
+
+template<typename T>
+inline void pstsdk::basic_table<T>::init_tc(heap& h, const node& n)
+{
     std::vector<byte> table_info = h.read(h.get_root_id());
     disk::tc_header* pheader = (disk::tc_header*)&table_info[0];
 
@@ -493,64 +1021,142 @@ inline pstsdk::basic_table<T>::basic_table(const node& n)
 
     m_prows = h.open_bth<row_id, T>(pheader->row_btree_id);
 
-    for(int i = 0; i < pheader->num_columns; ++i)
-        m_columns[pheader->columns[i].id] = pheader->columns[i];
-
-    for(int i = 0; i < disk::tc_offsets_max; ++i)
-        m_offsets[i] = pheader->size_offsets[i];
-
-    if(is_subnode_id(pheader->row_matrix_id))
-    {
-        m_pnode_rowarray.reset(new node(n.lookup(pheader->row_matrix_id)));
-    }
-    else if(pheader->row_matrix_id)
+    m_columns.resize(pheader->num_columns);
+    for(size_t i = 0; i < m_columns.size(); ++i)
     {
-        m_vec_rowarray = h.read(pheader->row_matrix_id);
+        m_columns[i].type = pheader->columns[i].type;
+        m_columns[i].id = pheader->columns[i].id;
+        m_columns[i].offset = pheader->columns[i].offset;
+        m_columns[i].size = pheader->columns[i].size;
+        m_columns[i].bit_offset = pheader->columns[i].bit_offset;
     }
+
+    init_rows(h, n, pheader->row_matrix_id, pheader->size_offsets);
 }
 
 template<typename T>
-inline pstsdk::basic_table<T>::basic_table(const node& n, alias_tag)
+inline void pstsdk::basic_table<T>::init_gust(heap& h, const node& n)
 {
-    heap h(n, disk::heap_sig_tc, alias_tag());
-
     std::vector<byte> table_info = h.read(h.get_root_id());
-    disk::tc_header* pheader = (disk::tc_header*)&table_info[0];
+    disk::gust_header* pheader = (disk::gust_header*)&table_info[0];
 
 #ifdef PSTSDK_VALIDATION_LEVEL_WEAK
-    if(pheader->signature != disk::heap_sig_tc)
-        throw sig_mismatch("heap_sig_tc expected", 0, n.get_id(), pheader->signature, disk::heap_sig_tc);
+    if(pheader->signature != disk::heap_sig_chtc)
+        throw sig_mismatch("heap_sig_chtc expected", 0, n.get_id(), pheader->signature, disk::heap_sig_chtc);
 #endif
 
     m_prows = h.open_bth<row_id, T>(pheader->row_btree_id);
 
-    for(int i = 0; i < pheader->num_columns; ++i)
-        m_columns[pheader->columns[i].id] = pheader->columns[i];
+    // the column descriptions live in a subnode of their own
+    m_columns.resize(pheader->num_columns);
+    if(pheader->num_columns)
+    {
+        node column_node(n.lookup(pheader->column_subnode));
+        std::vector<byte> buffer(pheader->num_columns * sizeof(disk::gust_column_description));
+
+#ifdef PSTSDK_VALIDATION_LEVEL_WEAK
+        if(column_node.size() < buffer.size())
+            throw std::length_error("gust column subnode too small");
+#endif
+
+        column_node.read(buffer, 0);
+        const disk::gust_column_description* pcolumns = (const disk::gust_column_description*)&buffer[0];
+
+        for(size_t i = 0; i < m_columns.size(); ++i)
+        {
+            m_columns[i].type = pcolumns[i].type;
+            m_columns[i].id = pcolumns[i].id;
+            m_columns[i].offset = pcolumns[i].offset;
+            m_columns[i].size = pcolumns[i].size;
+            m_columns[i].bit_offset = pcolumns[i].bit_offset;
+        }
+    }
+
+    init_rows(h, n, pheader->row_matrix_id, pheader->size_offsets);
+}
+
+namespace compiler_workarounds
+{
+
+struct column_id_less
+{
+    bool operator()(const pstsdk::table_column& lhs, const pstsdk::table_column& rhs) const
+        { return lhs.id < rhs.id; }
+};
+
+} // end namespace compiler_workarounds
+
+template<typename T>
+inline void pstsdk::basic_table<T>::init_rows(heap& h, const node& n, heapnode_id row_matrix_id, const ushort* size_offsets)
+{
+    if(is_subnode_id(row_matrix_id))
+    {
+        m_pnode_rowarray.reset(new node(n.lookup(row_matrix_id)));
+    }
+    else if(row_matrix_id)
+    {
+        m_vec_rowarray = h.read(row_matrix_id);
+    }
+
+    std::sort(m_columns.begin(), m_columns.end(), compiler_workarounds::column_id_less());
 
     for(int i = 0; i < disk::tc_offsets_max; ++i)
-        m_offsets[i] = pheader->size_offsets[i];
+        m_offsets[i] = size_offsets[i];
+
+#ifdef PSTSDK_VALIDATION_LEVEL_WEAK
+    if((m_pnode_rowarray || !m_vec_rowarray.empty()) && cb_per_row() == 0)
+        throw database_corrupt("table rows have no width");
+
+    if(m_offsets[disk::tc_offsets_one] > m_offsets[disk::tc_offsets_bitmap])
+        throw database_corrupt("table existence bitmap ends before it starts");
 
-    if(is_subnode_id(pheader->row_matrix_id))
+    // every cell and existence bit must lie within the row
+    ulong bitmap_bits = (m_offsets[disk::tc_offsets_bitmap] - m_offsets[disk::tc_offsets_one]) * 8;
+    for(size_t i = 0; i < m_columns.size(); ++i)
     {
-        m_pnode_rowarray.reset(new node(n.lookup(pheader->row_matrix_id)));
+        if(static_cast<ulong>(m_columns[i].offset) + m_columns[i].size > cb_per_row())
+            throw database_corrupt("table column extends past the end of the row");
+
+        if(m_columns[i].bit_offset >= bitmap_bits)
+            throw database_corrupt("table column existence bit outside the bitmap");
     }
-    else if(pheader->row_matrix_id)
+#endif
+
+    if(m_pnode_rowarray)
     {
-        m_vec_rowarray = h.read(pheader->row_matrix_id);
+        m_rows_per_page = m_pnode_rowarray->get_page_size(0) / cb_per_row();
+        m_num_rows = (m_pnode_rowarray->get_page_count()-1) * m_rows_per_page + m_pnode_rowarray->get_page_size(m_pnode_rowarray->get_page_count()-1) / cb_per_row();
+    }
+    else
+    {
+        m_rows_per_page = m_vec_rowarray.size() / cb_per_row();
+        m_num_rows = m_rows_per_page;
     }
 }
 
 template<typename T>
-inline size_t pstsdk::basic_table<T>::size() const
+inline const pstsdk::table_column* pstsdk::basic_table<T>::find_column(prop_id id) const
 {
-    if(m_pnode_rowarray)
-    {
-        return (m_pnode_rowarray->get_page_count()-1) * rows_per_page() + m_pnode_rowarray->get_page_size(m_pnode_rowarray->get_page_count()-1) / cb_per_row();
-    }
-    else 
+    size_t low = 0;
+    size_t high = m_columns.size();
+
+    while(low < high)
     {
-        return m_vec_rowarray.size() / cb_per_row();
+        size_t mid = (low + high) / 2;
+
+        if(m_columns[mid].id < id)
+            low = mid + 1;
+        else
+            high = mid;
     }
+
+    return (low < m_columns.size() && m_columns[low].id == id) ? &m_columns[low] : 0;
+}
+
+template<typename T>
+inline size_t pstsdk::basic_table<T>::size() const
+{
+    return m_num_rows;
 }
 
 template<typename T>
@@ -558,8 +1164,8 @@ inline std::vector<pstsdk::prop_id> pstsdk::basic_table<T>::get_prop_list() cons
 {
     std::vector<prop_id> props;
 
-    for(const_column_iter i = m_columns.begin(); i != m_columns.end(); ++i)
-        props.push_back(i->first);
+    for(size_t i = 0; i < m_columns.size(); ++i)
+        props.push_back(m_columns[i].id);
 
     return props;
 }
@@ -580,25 +1186,26 @@ inline pstsdk::ulong pstsdk::basic_table<T>::lookup_row(row_id id) const
 template<typename T>
 inline pstsdk::ulonglong pstsdk::basic_table<T>::get_cell_value(ulong row, prop_id id) const
 {
-    if(!prop_exists(row, id))
+    const table_column* column = find_column(id);
+
+    if(!column || !cell_exists(row, *column))
         throw key_not_found<prop_id>(id);
 
-    const_column_iter column = m_columns.find(id);
     ulonglong value;
 
-    switch(column->second.size)
+    switch(column->size)
     {
         case 8:
-            value = read_raw_row<ulonglong>(row, column->second.offset);
+            value = read_raw_row<ulonglong>(row, column->offset);
             break;
         case 4:
-            value = read_raw_row<ulong>(row, column->second.offset);
+            value = read_raw_row<ulong>(row, column->offset);
             break;
         case 2:
-            value = read_raw_row<ushort>(row, column->second.offset);
+            value = read_raw_row<ushort>(row, column->offset);
             break;
         case 1:
-            value = read_raw_row<byte>(row, column->second.offset);
+            value = read_raw_row<byte>(row, column->offset);
             break;
         default:
             throw database_corrupt("get_cell_value: invalid cell size");
@@ -651,12 +1258,12 @@ inline pstsdk::hnid_stream_device pstsdk::basic_table<T>::open_cell_stream(ulong
 template<typename T>
 inline pstsdk::prop_type pstsdk::basic_table<T>::get_prop_type(prop_id id) const
 {
-    const_column_iter iter = m_columns.find(id);
+    const table_column* column = find_column(id);
 
-    if(iter == m_columns.end())
+    if(!column)
         throw key_not_found<prop_id>(id);
 
-    return (prop_type)iter->second.type;
+    return (prop_type)column->type;
 }
 
 template<typename T>
@@ -688,49 +1295,582 @@ inline Val pstsdk::basic_table<T>::read_raw_row(ulong row, ushort offset) const
 }
 
 template<typename T>
-inline std::vector<pstsdk::byte> pstsdk::basic_table<T>::read_exists_bitmap(ulong row) const
+inline bool pstsdk::basic_table<T>::prop_exists(ulong row, prop_id id) const
+{
+    const table_column* column = find_column(id);
+
+    if(!column)
+        return false;
+
+    return cell_exists(row, *column);
+}
+
+template<typename T>
+inline const pstsdk::byte* pstsdk::basic_table<T>::read_rows(ulong row, ulong count, std::vector<byte>& buffer) const
 {
-    std::vector<byte> exists_bitmap(cb_per_row() - exists_bitmap_start());
+    if(m_pnode_rowarray)
+    {
+        buffer.resize(count * cb_per_row());
+        m_pnode_rowarray->read(buffer, row / rows_per_page(), (row % rows_per_page()) * cb_per_row());
+        return &buffer[0];
+    }
+
+    return &m_vec_rowarray[row * cb_per_row()];
+}
 
+template<typename T>
+inline pstsdk::ulonglong pstsdk::basic_table<T>::decode_cell(const byte* pcell, byte size)
+{
+    switch(size)
+    {
+        case 8:
+            {
+            ulonglong value;
+            memcpy(&value, pcell, sizeof(value));
+            return value;
+            }
+        case 4:
+            {
+            ulong value;
+            memcpy(&value, pcell, sizeof(value));
+            return value;
+            }
+        case 2:
+            {
+            ushort value;
+            memcpy(&value, pcell, sizeof(value));
+            return value;
+            }
+        case 1:
+            return *pcell;
+        default:
+            throw database_corrupt("decode_cell: invalid cell size");
+    }
+}
+
+template<typename T>
+inline void pstsdk::basic_table<T>::read_columns(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const
+{
+    read_columns_impl(start, count, ids, batch, true);
+}
+
+template<typename T>
+inline void pstsdk::basic_table<T>::read_exists(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch) const
+{
+    read_columns_impl(start, count, ids, batch, false);
+}
+
+template<typename T>
+inline std::vector<pstsdk::prop_id> pstsdk::basic_table<T>::get_row_prop_list(ulong row) const
+{
     if(row >= size())
         throw std::out_of_range("row >= size()");
 
-    if(m_pnode_rowarray)
+    std::vector<byte> buffer;
+    const byte* pexists = read_rows(row, 1, buffer) + exists_bitmap_start();
+    std::vector<prop_id> props;
+
+    for(size_t i = 0; i < m_columns.size(); ++i)
     {
-        ulong page_num = row / rows_per_page();
-        ulong page_offset = (row % rows_per_page()) * cb_per_row();
+        if(test_bit(pexists, m_columns[i].bit_offset))
+            props.push_back(m_columns[i].id);
+    }
+
+    return props;
+}
 
-        m_pnode_rowarray->read(exists_bitmap, page_num, page_offset + exists_bitmap_start());
+template<typename T>
+inline void pstsdk::basic_table<T>::read_columns_impl(ulong start, ulong count, const std::vector<prop_id>& ids, column_batch& batch, bool values) const
+{
+    if(start + count > size())
+        throw std::out_of_range("start + count > size()");
+
+    // resolve each requested column once, rather than once per cell
+    std::vector<const table_column*> columns(ids.size());
+    for(size_t i = 0; i < ids.size(); ++i)
+        columns[i] = find_column(ids[i]);
+
+    batch.reset(start, count, ids, values);
+
+    const ulong per_page = rows_per_page();
+    std::vector<byte> buffer;
+    ulong row = start;
+
+    while(row < start + count)
+    {
+        ulong page_end = std::min<ulong>(start + count, (row / per_page + 1) * per_page);
+
+        decode_rows(read_rows(row, page_end - row, buffer), row - start, page_end - row, columns, batch, values);
+        row = page_end;
     }
-    else
+}
+
+template<typename T>
+inline void pstsdk::basic_table<T>::decode_rows(const byte* prow, size_t first, size_t count, const std::vector<const table_column*>& columns, column_batch& batch, bool values) const
+{
+    const ulong cb_row = cb_per_row();
+    const ulong bitmap_start = exists_bitmap_start();
+
+    for(size_t i = first; i < first + count; ++i, prow += cb_row)
+    {
+        memcpy(&batch.m_row_ids[i], prow, sizeof(row_id));
+
+        for(size_t c = 0; c < columns.size(); ++c)
+        {
+            if(!columns[c] || !test_bit(prow + bitmap_start, columns[c]->bit_offset))
+                continue;
+
+            batch.m_validity[c][i >> 3] |= (0x80 >> (i & 7));
+            if(values)
+                batch.m_values[c][i] = decode_cell(prow + columns[c]->offset, columns[c]->size);
+        }
+    }
+}
+
+template<typename T>
+inline void pstsdk::basic_table<T>::parallel_scan(const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process, scan_executor& executor) const
+{
+    using namespace std::tr1::placeholders;
+
+    std::vector<const table_column*> columns(ids.size());
+    for(size_t i = 0; i < ids.size(); ++i)
+        columns[i] = find_column(ids[i]);
+
+    const ulong num_rows = size();
+    const ulong per_page = rows_per_page();
+    ulong row = 0;
+
+    // the jobs refer to columns, ids and process
+    scan_wait_guard guard(executor);
+
+    while(row < num_rows)
     {
-        memcpy(&exists_bitmap[0], &m_vec_rowarray[ row * cb_per_row() + exists_bitmap_start() ], exists_bitmap.size());
-    }    
+        // read a bounded number of pages, then let the executor catch up
+        for(ulong pages = 0; pages < table_scan_pages_in_flight && row < num_rows; ++pages)
+        {
+            std::tr1::shared_ptr<scan_job> job(new scan_job);
+            job->start = row;
+            job->count = std::min<ulong>(num_rows, (row / per_page + 1) * per_page) - row;
+
+            if(m_pnode_rowarray)
+                (void)read_rows(job->start, job->count, job->rows);
+
+            executor.submit(std::tr1::bind(&basic_table<T>::run_scan_job, this, job, std::tr1::cref(columns), std::tr1::cref(ids), std::tr1::cref(process)));
+            row += job->count;
+        }
 
-    return exists_bitmap;
+        executor.wait();
+    }
 }
 
 template<typename T>
-inline bool pstsdk::basic_table<T>::prop_exists(ulong row, prop_id id) const
+inline void pstsdk::basic_table<T>::run_scan_job(const std::tr1::shared_ptr<scan_job>& job, const std::vector<const table_column*>& columns, const std::vector<prop_id>& ids, const std::tr1::function<void (const column_batch&)>& process) const
+{
+    const byte* prow = job->rows.empty() ? &m_vec_rowarray[job->start * cb_per_row()] : &job->rows[0];
+
+    job->batch.reset(job->start, job->count, ids, true);
+    decode_rows(prow, 0, job->count, columns, job->batch, true);
+
+    process(job->batch);
+
+    // release the decode buffers as soon as the job is done
+    job->rows.clear();
+    job->batch = column_batch();
+}
+
+inline void pstsdk::column_batch::reset(ulong start, size_t count, const std::vector<prop_id>& ids, bool values)
+{
+    m_start = start;
+    m_rows = count;
+    m_ids = ids;
+    m_row_ids.resize(count);
+    m_values.resize(ids.size());
+    m_validity.resize(ids.size());
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        if(values)
+            m_values[i].assign(count, 0);
+        else
+            m_values[i].clear();
+        m_validity[i].assign((count + 7) / 8, 0);
+    }
+}
+
+template<typename T>
+inline std::vector<pstsdk::ulong> pstsdk::basic_table<T>::find_rows(const std::vector<column_predicate>& predicates) const
 {
-    const_column_iter column = m_columns.find(id);
+    // resolve each column once, rather than once per row
+    std::vector<const table_column*> columns(predicates.size());
+    for(size_t i = 0; i < predicates.size(); ++i)
+        columns[i] = find_column(predicates[i].get_prop_id());
+
+    std::vector<ulong> rows;
+    const ulong num_rows = size();
+    if(num_rows == 0)
+        return rows;
+
+    const ulong cb_row = cb_per_row();
+    const ulong per_page = rows_per_page();
+    const ulong bitmap_start = exists_bitmap_start();
+    std::vector<byte> buffer;
+    ulong row = 0;
+
+    while(row < num_rows)
+    {
+        ulong page_end = std::min<ulong>(num_rows, (row / per_page + 1) * per_page);
+        const byte* prow = read_rows(row, page_end - row, buffer);
+
+        for(; row < page_end; ++row, prow += cb_row)
+        {
+            bool match = true;
+
+            for(size_t i = 0; match && i < predicates.size(); ++i)
+            {
+                if(!columns[i])
+                {
+                    match = predicates[i].matches(false, 0, prop_type_unspecified, 0);
+                }
+                else
+                {
+                    bool exists = test_bit(prow + bitmap_start, columns[i]->bit_offset);
+                    ulonglong cell = exists ? decode_cell(prow + columns[i]->offset, columns[i]->size) : 0;
+                    match = predicates[i].matches(exists, cell, columns[i]->type, columns[i]->size);
+                }
+            }
+
+            if(match)
+                rows.push_back(row);
+        }
+    }
+
+    return rows;
+}
 
-    if(column == m_columns.end())
+inline bool pstsdk::column_predicate::matches(bool exists, ulonglong cell, ushort type, byte size) const
+{
+    if(m_op == predicate_exists)
+        return exists;
+    if(m_op == predicate_not_exists)
+        return !exists;
+    if(!exists)
         return false;
 
-    std::vector<byte> exists_map = read_exists_bitmap(row);
+    if(m_op == predicate_all_bits)
+        return (cell & m_value) == m_value;
+    if(m_op == predicate_any_bits)
+        return (cell & m_value) != 0;
+
+    // -1, 0 or 1 as the cell is less than, equal to or greater than the value
+    int order;
+    switch(type)
+    {
+    case prop_type_short:
+    case prop_type_long:
+    case prop_type_longlong:
+    case prop_type_currency:
+        {
+        // sign extend both from the width of the column
+        int shift = 64 - 8 * (size ? size : 8);
+        slonglong a = static_cast<slonglong>(cell << shift) >> shift;
+        slonglong b = static_cast<slonglong>(m_value << shift) >> shift;
+        order = (a < b ? -1 : (a > b ? 1 : 0));
+        }
+        break;
+    case prop_type_double:
+    case prop_type_apptime:
+        {
+        double a, b;
+        memcpy(&a, &cell, sizeof(a));
+        memcpy(&b, &m_value, sizeof(b));
+        order = (a < b ? -1 : (a > b ? 1 : 0));
+        }
+        break;
+    case prop_type_float:
+        {
+        float a, b;
+        ulong cell_bits = static_cast<ulong>(cell);
+        ulong value_bits = static_cast<ulong>(m_value);
+        memcpy(&a, &cell_bits, sizeof(a));
+        memcpy(&b, &value_bits, sizeof(b));
+        order = (a < b ? -1 : (a > b ? 1 : 0));
+        }
+        break;
+    default:
+        order = (cell < m_value ? -1 : (cell > m_value ? 1 : 0));
+        break;
+    }
+
+    switch(m_op)
+    {
+    case predicate_equal:
+        return order == 0;
+    case predicate_not_equal:
+        return order != 0;
+    case predicate_less:
+        return order < 0;
+    case predicate_less_equal:
+        return order <= 0;
+    case predicate_greater:
+        return order > 0;
+    case predicate_greater_equal:
+        return order >= 0;
+    default:
+        return false;
+    }
+}
 
-    return test_bit(&exists_map[0], column->second.bit_offset);
+inline bool pstsdk::table_impl::is_fixed_size(prop_type type)
+{
+    switch(type)
+    {
+    case prop_type_short:
+    case prop_type_long:
+    case prop_type_float:
+    case prop_type_double:
+    case prop_type_currency:
+    case prop_type_apptime:
+    case prop_type_error:
+    case prop_type_boolean:
+    case prop_type_longlong:
+    case prop_type_systime:
+        return true;
+    default:
+        return false;
+    }
+}
+
+inline pstsdk::ulonglong pstsdk::table_impl::sort_key(ulonglong cell, prop_type type)
+{
+    const ulonglong sign_bit = 0x8000000000000000ull;
+
+    switch(type)
+    {
+    case prop_type_short:
+        return static_cast<ulonglong>(static_cast<slonglong>(static_cast<short>(cell))) ^ sign_bit;
+    case prop_type_long:
+        return static_cast<ulonglong>(static_cast<slonglong>(static_cast<slong>(cell))) ^ sign_bit;
+    case prop_type_longlong:
+    case prop_type_currency:
+        return cell ^ sign_bit;
+    case prop_type_double:
+    case prop_type_apptime:
+        // negative doubles order in reverse of their bit patterns
+        return (cell & sign_bit) ? ~cell : (cell | sign_bit);
+    case prop_type_float:
+        {
+        // the same, for the 32 bit pattern in the low bytes of the cell
+        const ulong float_sign_bit = 0x80000000;
+        ulong bits = static_cast<ulong>(cell);
+        return (bits & float_sign_bit) ? static_cast<ulong>(~bits) : (bits | float_sign_bit);
+        }
+    default:
+        return cell;
+    }
+}
+
+inline pstsdk::ulonglong pstsdk::table_impl::hash_bytes(const std::vector<byte>& value)
+{
+    // FNV-1a
+    ulonglong hash = 0xcbf29ce484222325ull;
+
+    for(size_t i = 0; i < value.size(); ++i)
+    {
+        hash ^= value[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+inline void pstsdk::table_impl::radix_sort(std::vector<ulonglong>& keys, std::vector<ulong>& rows)
+{
+    std::vector<ulonglong> keys_out(keys.size());
+    std::vector<ulong> rows_out(rows.size());
+
+    for(int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[257] = { 0 };
+
+        for(size_t i = 0; i < keys.size(); ++i)
+            ++counts[((keys[i] >> shift) & 0xff) + 1];
+
+        // skip passes where every key has the same digit
+        bool single_bucket = false;
+        for(int b = 1; b <= 256; ++b)
+        {
+            if(counts[b] == keys.size())
+                single_bucket = true;
+            counts[b] += counts[b-1];
+        }
+        if(single_bucket)
+            continue;
+
+        for(size_t i = 0; i < keys.size(); ++i)
+        {
+            size_t pos = counts[(keys[i] >> shift) & 0xff]++;
+            keys_out[pos] = keys[i];
+            rows_out[pos] = rows[i];
+        }
+
+        keys.swap(keys_out);
+        rows.swap(rows_out);
+    }
+}
+
+namespace compiler_workarounds
+{
+
+// order (contents, row) pairs by contents only
+struct cell_contents_less
+{
+    bool operator()(const std::pair<std::vector<pstsdk::byte>, pstsdk::ulong>& lhs, const std::pair<std::vector<pstsdk::byte>, pstsdk::ulong>& rhs) const
+        { return lhs.first < rhs.first; }
+};
+
+struct cell_contents_greater
+{
+    bool operator()(const std::pair<std::vector<pstsdk::byte>, pstsdk::ulong>& lhs, const std::pair<std::vector<pstsdk::byte>, pstsdk::ulong>& rhs) const
+        { return rhs.first < lhs.first; }
+};
+
+} // end namespace compiler_workarounds
+
+inline std::tr1::shared_ptr<const std::vector<pstsdk::ulong> > pstsdk::table_impl::get_sort_order(prop_id id, bool descending) const
+{
+    ulong key = id | (descending ? 0x10000 : 0);
+    std::tr1::unordered_map<ulong, std::tr1::shared_ptr<const std::vector<ulong> > >::const_iterator iter = m_sort_orders.find(key);
+
+    if(iter != m_sort_orders.end())
+        return iter->second;
+
+    prop_type type = get_prop_type(id);
+    column_batch batch;
+    read_columns(0, size(), std::vector<prop_id>(1, id), batch);
+
+    std::tr1::shared_ptr<std::vector<ulong> > porder(new std::vector<ulong>);
+    std::vector<ulong> missing;
+    porder->reserve(batch.rows());
+
+    if(is_fixed_size(type))
+    {
+        std::vector<ulonglong> keys;
+        keys.reserve(batch.rows());
+
+        for(ulong row = 0; row < batch.rows(); ++row)
+        {
+            if(!batch.is_valid(row, 0))
+            {
+                missing.push_back(row);
+                continue;
+            }
+
+            ulonglong k = sort_key(batch.get_value(row, 0), type);
+            keys.push_back(descending ? ~k : k);
+            porder->push_back(row);
+        }
+
+        radix_sort(keys, *porder);
+    }
+    else
+    {
+        std::vector<std::pair<std::vector<byte>, ulong> > cells;
+
+        for(ulong row = 0; row < batch.rows(); ++row)
+        {
+            if(!batch.is_valid(row, 0))
+                missing.push_back(row);
+            else
+                cells.push_back(std::make_pair(read_cell(row, id), row));
+        }
+
+        if(descending)
+            std::stable_sort(cells.begin(), cells.end(), compiler_workarounds::cell_contents_greater());
+        else
+            std::stable_sort(cells.begin(), cells.end(), compiler_workarounds::cell_contents_less());
+
+        for(size_t i = 0; i < cells.size(); ++i)
+            porder->push_back(cells[i].second);
+    }
+
+    porder->insert(porder->end(), missing.begin(), missing.end());
+
+    m_sort_orders[key] = porder;
+
+    return porder;
+}
+
+inline const pstsdk::table_impl::column_index& pstsdk::table_impl::get_column_index(prop_id id) const
+{
+    std::tr1::unordered_map<prop_id, std::tr1::shared_ptr<const column_index> >::const_iterator iter = m_indexes.find(id);
+
+    if(iter != m_indexes.end())
+        return *iter->second;
+
+    prop_type type = get_prop_type(id);
+    column_batch batch;
+    read_columns(0, size(), std::vector<prop_id>(1, id), batch);
+
+    std::tr1::shared_ptr<column_index> pindex(new column_index);
+
+    for(ulong row = 0; row < batch.rows(); ++row)
+    {
+        if(!batch.is_valid(row, 0))
+            continue;
+
+        ulonglong key = is_fixed_size(type) ? batch.get_value(row, 0) : hash_bytes(read_cell(row, id));
+        (*pindex)[key].push_back(row);
+    }
+
+    m_indexes[id] = pindex;
+
+    return *pindex;
+}
+
+inline std::vector<pstsdk::ulong> pstsdk::table_impl::find_rows_by_value(prop_id id, ulonglong value) const
+{
+    if(!is_fixed_size(get_prop_type(id)))
+        throw std::invalid_argument("find_rows_by_value: column is variable length");
+
+    const column_index& index = get_column_index(id);
+    column_index::const_iterator iter = index.find(value);
+
+    return iter == index.end() ? std::vector<ulong>() : iter->second;
+}
+
+inline std::vector<pstsdk::ulong> pstsdk::table_impl::find_rows_by_value(prop_id id, const std::vector<byte>& value) const
+{
+    if(is_fixed_size(get_prop_type(id)))
+        throw std::invalid_argument("find_rows_by_value: column is fixed size");
+
+    const column_index& index = get_column_index(id);
+    column_index::const_iterator iter = index.find(hash_bytes(value));
+    std::vector<ulong> rows;
+
+    if(iter == index.end())
+        return rows;
+
+    // rule out hash collisions
+    for(size_t i = 0; i < iter->second.size(); ++i)
+    {
+        if(read_cell(iter->second[i], id) == value)
+            rows.push_back(iter->second[i]);
+    }
+
+    return rows;
 }
 
 inline pstsdk::table::table(const node& n)
+: m_pgroup(new alias_group(open_table(n)))
 {
-    m_ptable = open_table(n);
 }
 
-inline pstsdk::table::table(const table& other)
+inline void pstsdk::table::detach()
 {
-    m_ptable = open_table(other.m_ptable->get_node());
+    if(m_pgroup->shared)
+    {
+        m_pgroup->ptable = open_table(m_pgroup->ptable->get_node());
+        m_pgroup->shared = false;
+    }
 }
 
 #endif
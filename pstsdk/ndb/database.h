@@ -10,6 +10,8 @@
 
 #include <fstream>
 #include <memory>
+#include <vector>
+#include <algorithm>
 
 #include "pstsdk/util/btree.h"
 #include "pstsdk/util/errors.h"
@@ -57,6 +59,16 @@ std::tr1::shared_ptr<small_pst> open_small_pst(const std::wstring& filename);
 //! \ingroup ndb_databaserelated
 std::tr1::shared_ptr<large_pst> open_large_pst(const std::wstring& filename);
 
+//! \brief The default for how far apart two blocks may lie and still be
+//! fetched by a single read
+//! \sa db_context::set_read_coalesce_gap
+//! \ingroup ndb_databaserelated
+const size_t default_read_coalesce_gap = 4 * 1024;
+
+//! \brief The largest read the read planner will build by joining block reads
+//! \ingroup ndb_databaserelated
+const size_t max_coalesced_read_size = 1024 * 1024;
+
 //! \brief PST implementation
 //!
 //! The actual implementation of a database context - this class is responsible
@@ -81,6 +93,13 @@ public:
     block_info lookup_block_info(block_id bid); 
     //@}
 
+    //! \name Node existence
+    //@{
+    bool node_exists(node_id nid);
+    void set_node_filter(const std::tr1::shared_ptr<const bloom_filter>& filter)
+        { m_node_filter = filter; }
+    //@}
+
     //! \name Page factory functions
     //@{
     std::tr1::shared_ptr<bbt_page> read_bbt_root();
@@ -117,6 +136,16 @@ public:
     std::tr1::shared_ptr<subnode_block> read_subnode_block(const shared_db_ptr& parent, const block_info& bi);
     std::tr1::shared_ptr<subnode_leaf_block> read_subnode_leaf_block(const shared_db_ptr& parent, const block_info& bi);
     std::tr1::shared_ptr<subnode_nonleaf_block> read_subnode_nonleaf_block(const shared_db_ptr& parent, const block_info& bi);
+
+    std::vector<std::tr1::shared_ptr<external_block> > read_external_blocks(const shared_db_ptr& parent, const std::vector<block_id>& bids);
+    //@}
+
+    //! \name Read planning
+    //@{
+    size_t get_read_coalesce_gap() const
+        { return m_read_coalesce_gap; }
+    void set_read_coalesce_gap(size_t gap)
+        { m_read_coalesce_gap = gap; }
     //@}
 
 //! \cond write_api
@@ -147,6 +176,56 @@ protected:
     //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If the block's CRC doesn't match the trailer
     //! \returns The validated block data (still "encrypted")
     std::vector<byte> read_block_data(const block_info& bi);
+    //! \brief Check a block's size and location before reading it
+    //! \param[in] bi The block information to check
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of the block appear incorrect
+    //! \returns The size of the block on disk, including the trailer
+    size_t validate_block_extent(const block_info& bi);
+    //! \brief Check the trailer (and CRC) of block data read from disk
+    //! \param[in] bi The block information the data was read for
+    //! \param[in] pdata The block data, of the size returned by validate_block_extent
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of the block appear incorrect
+    //! \throws sig_mismatch (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the block trailer's signature appears incorrect
+    //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If the block's CRC doesn't match the trailer
+    void validate_block_data(const block_info& bi, const byte* pdata);
+    //! \brief Decode validated block data and construct an external_block from it
+    //! \param[in] parent The context to open this block in
+    //! \param[in] bi The block information the data was read for
+    //! \param[in,out] buffer The block data as read from disk. Decoded in place, and consumed if possible.
+    //! \returns The external_block
+    std::tr1::shared_ptr<external_block> make_external_block(const shared_db_ptr& parent, const block_info& bi, std::vector<byte>& buffer);
+
+    //! \brief A single read issued by the read planner
+    //!
+    //! Covers the disk extent of one or more blocks, plus whatever unused
+    //! space lies between them.
+    struct planned_read
+    {
+        ulonglong address;              //!< Where the read starts
+        size_t size;                    //!< How many bytes to read
+        std::vector<size_t> blocks;     //!< Indexes of the blocks served by this read
+    };
+
+    //! \brief Plan the reads needed to fetch a set of blocks
+    //!
+    //! Blocks are sorted by address, and a block is folded into the 
+    //! preceding read if it starts no more than get_read_coalesce_gap() 
+    //! bytes past the end of it, and the read would not grow beyond
+    //! \ref max_coalesced_read_size.
+    //! \param[in] infos The blocks to read. Blocks with an id of zero are skipped.
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of a block appear incorrect
+    //! \returns The reads to issue, in file order
+    std::vector<planned_read> plan_block_reads(const std::vector<block_info>& infos);
+    //! \brief Read the data of several blocks, perform validation checks
+    //!
+    //! Equivalent to calling read_block_data for each block, but the 
+    //! reads are issued as determined by plan_block_reads
+    //! \param[in] infos The blocks to read. Blocks with an id of zero yield an empty buffer.
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of a block appear incorrect
+    //! \throws sig_mismatch (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If a block trailer's signature appears incorrect
+    //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If a block's CRC doesn't match the trailer
+    //! \returns The validated block data (still "encrypted"), in the same order as infos
+    std::vector<std::vector<byte> > read_blocks_data(const std::vector<block_info>& infos);
     //! \brief Read page data, perform validation checks
     //! \param[in] pi The page information to read from disk
     //! \throws unexpected_page (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of the page appear incorrect
@@ -173,6 +252,8 @@ protected:
     disk::header<T> m_header;
     std::tr1::shared_ptr<bbt_page> m_bbt_root;
     std::tr1::shared_ptr<nbt_page> m_nbt_root;
+    size_t m_read_coalesce_gap;     //!< Largest hole between two blocks which the read planner will read through
+    std::tr1::shared_ptr<const bloom_filter> m_node_filter;  //!< Filter over the node ids in the NBT, if installed
 };
 
 //! \cond dont_show_these_member_function_specializations
@@ -242,6 +323,20 @@ inline std::tr1::shared_ptr<pstsdk::large_pst> pstsdk::open_large_pst(const std:
 
 template<typename T>
 inline std::vector<pstsdk::byte> pstsdk::database_impl<T>::read_block_data(const block_info& bi)
+{
+    size_t aligned_size = validate_block_extent(bi);
+
+    std::vector<byte> buffer(aligned_size);
+
+    m_file.read(buffer, bi.address);    
+
+    validate_block_data(bi, &buffer[0]);
+
+    return buffer;
+}
+
+template<typename T>
+inline size_t pstsdk::database_impl<T>::validate_block_extent(const block_info& bi)
 {
     size_t aligned_size = disk::align_disk<T>(bi.size);
 
@@ -253,12 +348,16 @@ inline std::vector<pstsdk::byte> pstsdk::database_impl<T>::read_block_data(const
         throw unexpected_block("nonsensical block location; past eof");
 #endif
 
-    std::vector<byte> buffer(aligned_size);
-    disk::block_trailer<T>* bt = (disk::block_trailer<T>*)(&buffer[0] + aligned_size - sizeof(disk::block_trailer<T>));
-
-    m_file.read(buffer, bi.address);    
+    return aligned_size;
+}
 
+template<typename T>
+inline void pstsdk::database_impl<T>::validate_block_data(const block_info& bi, const byte* pdata)
+{
 #ifdef PSTSDK_VALIDATION_LEVEL_WEAK
+    size_t aligned_size = disk::align_disk<T>(bi.size);
+    const disk::block_trailer<T>* bt = (const disk::block_trailer<T>*)(pdata + aligned_size - sizeof(disk::block_trailer<T>));
+
     if(bt->bid != bi.id)
         throw unexpected_block("wrong block id");
 
@@ -270,12 +369,10 @@ inline std::vector<pstsdk::byte> pstsdk::database_impl<T>::read_block_data(const
 #endif
 
 #ifdef PSTSDK_VALIDATION_LEVEL_FULL
-    ulong crc = disk::compute_crc(&buffer[0], bi.size);
+    ulong crc = disk::compute_crc(pdata, bi.size);
     if(crc != bt->crc)
         throw crc_fail("block crc failure", bi.address, bi.id, crc, bt->crc);
 #endif
-
-    return buffer;
 }
 
 template<typename T>
@@ -341,7 +438,7 @@ inline std::tr1::shared_ptr<pstsdk::nbt_page> pstsdk::database_impl<T>::read_nbt
 
 template<typename T>
 inline pstsdk::database_impl<T>::database_impl(const std::wstring& filename)
-: m_file(filename)
+: m_file(filename), m_read_coalesce_gap(default_read_coalesce_gap)
 {
     std::vector<byte> buffer(sizeof(m_header));
     m_file.read(buffer, 0);
@@ -538,9 +635,45 @@ inline std::tr1::shared_ptr<pstsdk::nbt_page> pstsdk::database_impl<T>::read_nbt
 template<typename T>
 inline pstsdk::node_info pstsdk::database_impl<T>::lookup_node_info(node_id nid)
 {
+    if(m_node_filter && !m_node_filter->may_contain(nid))
+        throw key_not_found<node_id>(nid);
+
     return read_nbt_root()->lookup(nid); 
 }
 
+template<typename T>
+inline bool pstsdk::database_impl<T>::node_exists(node_id nid)
+{
+    if(m_node_filter && !m_node_filter->may_contain(nid))
+        return false;
+
+    try
+    {
+        read_nbt_root()->lookup(nid);
+    }
+    catch(key_not_found<node_id>&)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+inline void pstsdk::db_context::build_node_filter()
+{
+    std::tr1::shared_ptr<nbt_page> nbt_root = read_nbt_root();
+    std::vector<node_id> ids;
+
+    for(const_nodeinfo_iterator iter = nbt_root->begin(); iter != nbt_root->end(); ++iter)
+        ids.push_back(iter->id);
+
+    std::tr1::shared_ptr<bloom_filter> filter(new bloom_filter(ids.size()));
+    for(size_t i = 0; i < ids.size(); ++i)
+        filter->add(ids[i]);
+
+    set_node_filter(filter);
+}
+
 template<typename T>
 inline pstsdk::block_info pstsdk::database_impl<T>::lookup_block_info(block_id bid)
 {
@@ -691,6 +824,12 @@ inline std::tr1::shared_ptr<pstsdk::external_block> pstsdk::database_impl<T>::re
 
     std::vector<byte> buffer = read_block_data(bi);
 
+    return make_external_block(parent, bi, buffer);
+}
+
+template<typename T>
+inline std::tr1::shared_ptr<pstsdk::external_block> pstsdk::database_impl<T>::make_external_block(const shared_db_ptr& parent, const block_info& bi, std::vector<byte>& buffer)
+{
     if(m_header.bCryptMethod == disk::crypt_method_permute)
     {
         disk::permute(&buffer[0], bi.size, false);
@@ -707,6 +846,102 @@ inline std::tr1::shared_ptr<pstsdk::external_block> pstsdk::database_impl<T>::re
 #endif
 }
 
+template<typename T>
+inline std::vector<std::tr1::shared_ptr<pstsdk::external_block> > pstsdk::database_impl<T>::read_external_blocks(const shared_db_ptr& parent, const std::vector<block_id>& bids)
+{
+    std::vector<block_info> infos(bids.size());
+
+    for(size_t i = 0; i < bids.size(); ++i)
+    {
+        infos[i] = lookup_block_info(bids[i]);
+
+        if(infos[i].id != 0 && !disk::bid_is_external(infos[i].id))
+            throw unexpected_block("External BID expected");
+    }
+
+    std::vector<std::vector<byte> > buffers = read_blocks_data(infos);
+    std::vector<std::tr1::shared_ptr<external_block> > blocks(bids.size());
+
+    for(size_t i = 0; i < infos.size(); ++i)
+    {
+        if(infos[i].id == 0)
+            blocks[i] = read_external_block(parent, infos[i]);
+        else
+            blocks[i] = make_external_block(parent, infos[i], buffers[i]);
+    }
+
+    return blocks;
+}
+
+template<typename T>
+inline std::vector<typename pstsdk::database_impl<T>::planned_read> pstsdk::database_impl<T>::plan_block_reads(const std::vector<block_info>& infos)
+{
+    std::vector<std::pair<ulonglong, size_t> > by_address;
+    std::vector<planned_read> plan;
+
+    for(size_t i = 0; i < infos.size(); ++i)
+    {
+        if(infos[i].id != 0)
+            by_address.push_back(std::make_pair(infos[i].address, i));
+    }
+
+    std::sort(by_address.begin(), by_address.end());
+
+    for(size_t i = 0; i < by_address.size(); ++i)
+    {
+        ulonglong address = by_address[i].first;
+        size_t size = validate_block_extent(infos[by_address[i].second]);
+
+        if(!plan.empty())
+        {
+            planned_read& last = plan.back();
+            ulonglong last_end = last.address + last.size;
+            ulonglong new_end = std::max(last_end, address + size);
+
+            if(address <= last_end + m_read_coalesce_gap && new_end - last.address <= max_coalesced_read_size)
+            {
+                last.size = static_cast<size_t>(new_end - last.address);
+                last.blocks.push_back(by_address[i].second);
+                continue;
+            }
+        }
+
+        plan.push_back(planned_read());
+        plan.back().address = address;
+        plan.back().size = size;
+        plan.back().blocks.push_back(by_address[i].second);
+    }
+
+    return plan;
+}
+
+template<typename T>
+inline std::vector<std::vector<pstsdk::byte> > pstsdk::database_impl<T>::read_blocks_data(const std::vector<block_info>& infos)
+{
+    std::vector<std::vector<byte> > buffers(infos.size());
+    std::vector<planned_read> plan = plan_block_reads(infos);
+    std::vector<byte> read_buffer;
+
+    for(size_t i = 0; i < plan.size(); ++i)
+    {
+        read_buffer.resize(plan[i].size);
+        m_file.read(read_buffer, plan[i].address);
+
+        // slice the read up into its blocks
+        for(size_t j = 0; j < plan[i].blocks.size(); ++j)
+        {
+            const block_info& bi = infos[plan[i].blocks[j]];
+            const byte* pdata = &read_buffer[0] + static_cast<size_t>(bi.address - plan[i].address);
+
+            validate_block_data(bi, pdata);
+
+            buffers[plan[i].blocks[j]].assign(pdata, pdata + disk::align_disk<T>(bi.size));
+        }
+    }
+
+    return buffers;
+}
+
 template<typename T>
 inline std::tr1::shared_ptr<pstsdk::subnode_block> pstsdk::database_impl<T>::read_subnode_block(const shared_db_ptr& parent, const block_info& bi)
 {
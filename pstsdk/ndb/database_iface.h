@@ -10,6 +10,7 @@
 #define PSTSDK_NDB_DATABASE_IFACE_H
 
 #include <memory>
+#include <vector>
 #ifdef __GNUC__
 #include <tr1/memory>
 #endif
@@ -139,6 +140,31 @@ public:
     virtual block_info lookup_block_info(block_id bid) = 0;
     //@}
 
+    //! \name Node existence
+    //@{
+    //! \brief Check whether a node exists
+    //!
+    //! Unlike lookup_node_info, a missing node is reported rather than 
+    //! thrown. Once a node filter is installed, most missing nodes are
+    //! reported without reading any NBT page.
+    //! \param[in] nid The id of the node to check
+    //! \returns true if the node exists
+    virtual bool node_exists(node_id nid) = 0;
+    //! \brief Install a filter over the node ids in this context
+    //!
+    //! From then on, lookups of nodes the filter rejects fail (or, for 
+    //! node_exists, return false) without walking the NBT. The filter must
+    //! have had every node_id in the NBT added to it.
+    //! \param[in] filter The filter, or an empty pointer to remove it
+    virtual void set_node_filter(const std::tr1::shared_ptr<const bloom_filter>& filter) = 0;
+    //! \brief Build and install a filter over the node ids in this context
+    //!
+    //! This walks the whole NBT once. Callers who are iterating the NBT 
+    //! anyway can build the filter themselves and pass it to 
+    //! set_node_filter instead.
+    void build_node_filter();
+    //@}
+
     //! \name Page factory functions
     //@{
     //! \brief Get the root of the BBT of this context
@@ -417,6 +443,45 @@ public:
     //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If the block's CRC doesn't match the trailer
     //! \returns The requested block
     virtual std::tr1::shared_ptr<subnode_nonleaf_block> read_subnode_nonleaf_block(const shared_db_ptr& parent, const block_info& bi) = 0;
+
+    //! \brief Open a set of external_blocks in this context
+    //! \param[in] bids The ids of the blocks to open
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of a block appear incorrect
+    //! \throws sig_mismatch (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If a block trailer's signature appears incorrect
+    //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If a block's CRC doesn't match the trailer
+    //! \returns The requested blocks, in the same order as bids
+    std::vector<std::tr1::shared_ptr<external_block> > read_external_blocks(const std::vector<block_id>& bids) { return read_external_blocks(shared_from_this(), bids); }
+    //! \brief Open a set of external_blocks in the specified context
+    //!
+    //! This is equivalent to calling read_external_block for each block id,
+    //! except the context is free to fetch the blocks in whatever order and
+    //! grouping is cheapest - blocks which sit next to each other in the file
+    //! are fetched with a single read.
+    //! \param[in] parent The context to open these blocks in. It must be either this context or a child context of this context.
+    //! \param[in] bids The ids of the blocks to open
+    //! \throws unexpected_block (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If the parameters of a block appear incorrect
+    //! \throws sig_mismatch (\ref PSTSDK_VALIDATION_LEVEL_WEAK) If a block trailer's signature appears incorrect
+    //! \throws crc_fail (\ref PSTSDK_VALIDATION_LEVEL_WEAK "PSTSDK_VALIDATION_LEVEL_FULL") If a block's CRC doesn't match the trailer
+    //! \returns The requested blocks, in the same order as bids
+    virtual std::vector<std::tr1::shared_ptr<external_block> > read_external_blocks(const shared_db_ptr& parent, const std::vector<block_id>& bids) = 0;
+    //@}
+
+    //! \name Read planning
+    //@{
+    //! \brief Get the largest hole between two blocks which is read through 
+    //! in order to fetch both with a single read
+    //! \returns The gap, in bytes
+    virtual size_t get_read_coalesce_gap() const = 0;
+    //! \brief Set the largest hole between two blocks which is read through
+    //! in order to fetch both with a single read
+    //!
+    //! This applies when several blocks are requested together, as with
+    //! read_external_blocks. A larger gap trades reading (and discarding)
+    //! unused bytes for fewer reads, which pays off on storage where seeks
+    //! or round trips dominate. A gap of zero only joins blocks which 
+    //! directly follow one another in the file.
+    //! \param[in] gap The gap, in bytes
+    virtual void set_read_coalesce_gap(size_t gap) = 0;
     //@}
 
 //! \cond write_api
@@ -13,6 +13,13 @@
 #include <algorithm>
 #include <memory>
 #include <cassert>
+#if __GNUC__
+# include <tr1/unordered_map>
+# include <tr1/functional>
+#else
+# include <unordered_map>
+# include <functional>
+#endif
 #include <boost/iterator/transform_iterator.hpp>
 #include <boost/iostreams/concepts.hpp>
 #ifdef _MSC_VER
@@ -27,6 +34,8 @@
 #include "pstsdk/util/util.h"
 #include "pstsdk/util/btree.h"
 
+#include "pstsdk/disk/disk.h"
+
 #include "pstsdk/ndb/database_iface.h"
 
 #ifdef _MSC_VER
@@ -40,6 +49,71 @@ namespace pstsdk
 //! \defgroup ndb_noderelated Node
 //! \ingroup ndb
 
+//! \brief A flat hash index over all of the subnodes of a node
+//!
+//! The subnode block tree of a node is searched one level at a time, 
+//! with each subnode_nonleaf_block loading its children as they are 
+//! visited. For nodes which get a lot of subnode lookups, this index 
+//! gathers every \ref subnode_info of the tree into a single open
+//! addressed (linear probing) table, making a lookup a hash and usually
+//! a single probe.
+//!
+//! The index is immutable once built, so it is shared between copies of 
+//! a node the same way the subnode block itself is.
+//! \ingroup ndb_noderelated
+class subnode_index
+{
+public:
+    //! \brief Build the index from a range of subnode_info
+    //! \param[in] begin The first subnode_info to index
+    //! \param[in] end One past the last subnode_info to index
+    subnode_index(const_subnodeinfo_iterator begin, const_subnodeinfo_iterator end);
+
+    //! \brief Lookup a subnode_info by node id
+    //! \throws key_not_found<node_id> if a subnode with the specified node_id was not found
+    //! \param[in] id The subnode id to find
+    //! \returns The subnode_info
+    const subnode_info& lookup(node_id id) const;
+    //! \brief Find a subnode_info by node id
+    //! \param[in] id The subnode id to find
+    //! \returns The subnode_info, or 0 if there is no subnode with that id
+    const subnode_info* find(node_id id) const;
+
+    //! \brief Get the number of subnodes indexed
+    //! \returns The subnode count
+    size_t size() const { return m_count; }
+
+private:
+    //! \brief The home slot of a node id
+    size_t hash(node_id id) const
+        { return static_cast<size_t>((id ^ (id >> 16)) * 0x45d9f3bu) & (m_slots.size() - 1); }
+
+    std::vector<subnode_info> m_slots;  //!< The table; unused slots have an id of zero
+    size_t m_count;                     //!< Number of occupied slots
+};
+
+//! \brief The number of lookups after which a node indexes its subnodes
+//!
+//! The first few lookups on a node walk the subnode block tree. Once a node
+//! has seen this many, it builds a \ref subnode_index and serves further 
+//! lookups from that.
+//! \ingroup ndb_noderelated
+const uint subnode_index_lookup_threshold = 4;
+
+//! \brief A consumer of data streamed out of a node
+//!
+//! Called once per contiguous run of data, in order. The data is only valid
+//! for the duration of the call.
+//! \ingroup ndb_noderelated
+typedef std::tr1::function<void (const byte*, size_t)> byte_sink;
+
+//! \brief The number of external blocks read at once when streaming
+//!
+//! Bounds the memory used by node_impl::stream_to to this many pages, 
+//! regardless of the size of the node.
+//! \ingroup ndb_noderelated
+const uint stream_batch_pages = 32;
+
 //! \brief The node implementation
 //!
 //! The node class is really divided into two classes, node and
@@ -68,7 +142,7 @@ public:
     //! \param[in] db The database context we're located in
     //! \param[in] info Information about this node
     node_impl(const shared_db_ptr& db, const node_info& info)
-        : m_id(info.id), m_original_data_id(info.data_bid), m_original_sub_id(info.sub_bid), m_original_parent_id(info.parent_id), m_parent_id(info.parent_id), m_db(db) { }
+        : m_id(info.id), m_original_data_id(info.data_bid), m_original_sub_id(info.sub_bid), m_original_parent_id(info.parent_id), m_lookup_count(0), m_parent_id(info.parent_id), m_db(db) { }
 
     //! \brief Constructor for subnodes
     //!
@@ -76,7 +150,7 @@ public:
     //! \param[in] container_node The parent or containing node
     //! \param[in] info Information about this node
     node_impl(const std::tr1::shared_ptr<node_impl>& container_node, const subnode_info& info)
-        : m_id(info.id), m_original_data_id(info.data_bid), m_original_sub_id(info.sub_bid), m_original_parent_id(0), m_parent_id(0), m_pcontainer_node(container_node), m_db(container_node->m_db) { }
+        : m_id(info.id), m_original_data_id(info.data_bid), m_original_sub_id(info.sub_bid), m_original_parent_id(0), m_lookup_count(0), m_parent_id(0), m_pcontainer_node(container_node), m_db(container_node->m_db) { }
 
     //! \brief Set one node equal to another
     //!
@@ -87,7 +161,7 @@ public:
     //! \param[in] other The node to assign from
     //! \returns *this after the assignment is done
     node_impl& operator=(const node_impl& other)
-        { m_pdata = other.m_pdata; m_psub = other.m_psub; return *this; }
+        { m_pdata = other.m_pdata; m_psub = other.m_psub; m_psub_index = other.m_psub_index; m_pprefetched = other.m_pprefetched; return *this; }
 
     //! \brief Get the id of this node
     //! \returns The id
@@ -164,6 +238,26 @@ public:
     //! \returns The amount of data read
     size_t read_raw(byte* pdest_buffer, size_t size, ulong offset) const;
 
+    //! \brief Read the entire contents of this node
+    //!
+    //! For nodes stored across many blocks, this is considerably cheaper 
+    //! than read(). Rather than loading blocks one at a time as the read
+    //! reaches them, every block of each extended_block is requested from 
+    //! the database context at once, which fetches them in file order,
+    //! coalescing adjacent blocks into single reads.
+    //! \returns A buffer containing the node's data
+    std::vector<byte> read_all() const;
+
+    //! \brief Stream the entire contents of this node to a sink
+    //!
+    //! Unlike read_all(), the data is never materialized in one buffer. 
+    //! Blocks are read in batches of \ref stream_batch_pages, passed to the
+    //! sink page by page and then released, so memory use does not grow with
+    //! the size of the node.
+    //! \param[in] sink Called with each page of data, in order
+    //! \returns The amount of data streamed
+    size_t stream_to(const byte_sink& sink) const;
+
 //! \cond write_api
     size_t write(const std::vector<byte>& buffer, ulong offset);
     template<typename T> void write(const T& obj, ulong offset);
@@ -199,12 +293,55 @@ public:
     const_subnodeinfo_iterator subnode_info_end() const;
 
     //! \brief Lookup a subnode by node id
+    //!
+    //! After \ref subnode_index_lookup_threshold lookups, the node builds 
+    //! a \ref subnode_index and uses it from then on.
     //! \throws key_not_found<node_id> if a subnode with the specified node_id was not found
     //! \param[in] id The subnode id to find
     //! \returns The subnode
     node lookup(node_id id) const;
 
+    //! \brief Index all subnodes of this node up front
+    //!
+    //! Builds the \ref subnode_index immediately, rather than waiting for
+    //! repeated lookups to trigger it. Useful before a bulk pass which will
+    //! open many subnodes by id.
+    //! \returns The index
+    const subnode_index& build_subnode_index() const;
+
+    //! \brief Check whether this node has a given subnode
+    //!
+    //! Answered by a single descent of the subnode tree, without throwing on
+    //! a miss. Checks count towards \ref subnode_index_lookup_threshold as
+    //! lookups do, and once the \ref subnode_index is built it is used
+    //! instead.
+    //! \param[in] id The subnode id to check
+    //! \returns true if the subnode exists
+    bool subnode_exists(node_id id) const;
+
+    //! \brief Read the data blocks of this node and some of its subnodes up front
+    //!
+    //! This node's data block and the data blocks of the requested subnodes
+    //! are fetched together with \ref db_context::read_external_blocks, so
+    //! blocks lying near each other in the file share a single read. 
+    //! Subnodes later opened through this node (or a copy of it) take their
+    //! prefetched data block rather than reading it again.
+    //!
+    //! Subnodes which don't exist are ignored. Data blocks which are not
+    //! external blocks (values spanning several blocks) are left to be
+    //! read on demand.
+    //! \param[in] subnodes The ids of the subnodes to prefetch
+    void prefetch(const std::vector<node_id>& subnodes) const;
+
 private:
+    //! \brief Type of the collection of prefetched subnode data blocks
+    typedef std::tr1::unordered_map<block_id, std::tr1::shared_ptr<data_block> > prefetched_blocks;
+
+    //! \brief Find a data block read by \ref prefetch
+    //! \param[in] bid The block id of the data block
+    //! \returns The block, or an empty pointer if it wasn't prefetched
+    std::tr1::shared_ptr<data_block> find_prefetched(block_id bid) const;
+
     //! \brief Loads the data block from disk
     //! \returns The data block for this node
     data_block* ensure_data_block() const;
@@ -219,6 +356,9 @@ private:
 
     mutable std::tr1::shared_ptr<data_block> m_pdata;    //!< The data block
     mutable std::tr1::shared_ptr<subnode_block> m_psub;  //!< The subnode block
+    mutable std::tr1::shared_ptr<subnode_index> m_psub_index;    //!< Hash index over the subnodes, once built
+    mutable uint m_lookup_count;                    //!< Number of lookups served by walking the subnode tree
+    mutable std::tr1::shared_ptr<prefetched_blocks> m_pprefetched; //!< Subnode data blocks read by prefetch()
     node_id m_parent_id;                            //!< The parent node_id to this node
 
     std::tr1::shared_ptr<node_impl> m_pcontainer_node;   //!< The container node, of which we're a subnode, if applicable
@@ -256,12 +396,18 @@ private:
 //! The boost iostream library requires that one defines a device, which
 //! implements a few key operations. This is the device for streaming out
 //! of a node.
+//!
+//! The device keeps a cursor on the external block ("page") the current
+//! position falls in, so sequential reads are served directly out of that
+//! block instead of descending the extended_block tree for every chunk.
+//! When the cursor moves onto a page, the following page is fetched as well
+//! so a sequential reader always finds its next block already loaded.
 //! \ingroup ndb_noderelated
 class node_stream_device : public boost::iostreams::device<boost::iostreams::seekable>
 {
 public:
     //! \brief Default construct the node stream device
-    node_stream_device() : m_pos(0) { }
+    node_stream_device() : m_pos(0), m_page_num(0), m_page_start(0), m_page_stride(0) { }
 
     //! \brief Read data from this node into the buffer at the current position
     //! \param[out] pbuffer The buffer to store the results into
@@ -282,10 +428,25 @@ public:
 private:
     friend class node;
     //! \brief Construct the device from a node
-    node_stream_device(std::tr1::shared_ptr<node_impl>& _node) : m_pos(0), m_pnode(_node) { }
+    node_stream_device(std::tr1::shared_ptr<node_impl>& _node) : m_pos(0), m_pnode(_node), m_page_num(0), m_page_start(0), m_page_stride(0) { }
+
+    //! \brief Position the cursor on the page containing the current position
+    //!
+    //! The cached page is kept if it still covers m_pos; stepping off the end
+    //! of it moves onto the prefetched next page. Any other movement, or a
+    //! change of the node's underlying data block, locates the page anew.
+    //! \returns false if the current position is at or past the end of the node
+    bool position_cursor();
 
     std::streamsize m_pos;              //!< The stream's current position
     std::tr1::shared_ptr<node_impl> m_pnode; //!< The node this stream is over
+
+    std::tr1::shared_ptr<data_block> m_pdata;           //!< The data block the cursor was positioned against
+    std::tr1::shared_ptr<external_block> m_ppage;       //!< The page the cursor is on
+    std::tr1::shared_ptr<external_block> m_pnext_page;  //!< The page following m_ppage, if any
+    uint m_page_num;                    //!< The ordinal of m_ppage
+    std::streamsize m_page_start;       //!< The node offset m_ppage starts at
+    std::streamsize m_page_stride;      //!< The logical size of every page but the last
 };
 
 //! \brief The actual node stream, defined using the boost iostream library
@@ -376,6 +537,13 @@ public:
     //! \copydoc node_impl::is_subnode()
     bool is_subnode() { return m_pimpl->is_subnode(); } 
 
+    //! \copydoc node_impl::subnode_exists()
+    bool subnode_exists(node_id id) const
+        { return m_pimpl->subnode_exists(id); }
+    //! \copydoc node_impl::prefetch()
+    void prefetch(const std::vector<node_id>& subnodes) const
+        { m_pimpl->prefetch(subnodes); }
+
     //! \copydoc node_impl::get_data_block()
     std::tr1::shared_ptr<data_block> get_data_block() const
         { return m_pimpl->get_data_block(); }
@@ -395,6 +563,12 @@ public:
     //! \copydoc node_impl::read(uint,ulong) const
     template<typename T> T read(uint page_num, ulong offset) const
         { return m_pimpl->read<T>(page_num, offset); }
+    //! \copydoc node_impl::read_all()
+    std::vector<byte> read_all() const
+        { return m_pimpl->read_all(); }
+    //! \copydoc node_impl::stream_to()
+    size_t stream_to(const byte_sink& sink) const
+        { return m_pimpl->stream_to(sink); }
 
 //! \cond write_api
     size_t write(std::vector<byte>& buffer, ulong offset) 
@@ -460,6 +634,9 @@ public:
     //! \copydoc node_impl::lookup()
     node lookup(node_id id) const
         { return m_pimpl->lookup(id); }
+    //! \copydoc node_impl::build_subnode_index()
+    const subnode_index& build_subnode_index() const
+        { return m_pimpl->build_subnode_index(); }
 
 private:
     std::tr1::shared_ptr<node_impl> m_pimpl; //!< Pointer to the node implementation
@@ -663,6 +840,26 @@ public:
 //! \cond write_api
     size_t write_raw(const byte* psrc_buffer, size_t size, ulong offset, std::tr1::shared_ptr<data_block>& presult);
 //! \endcond
+
+    //! \brief Read the entire contents of this block
+    //!
+    //! Child blocks which have not been loaded yet are requested from the
+    //! database context in one batch per xblock, and copied straight into 
+    //! the destination without being cached on this block. No child is 
+    //! copied past its own slot or past the end of the destination, even if
+    //! a corrupt xblock lists more or larger children than it should.
+    //! \param[out] pdest_buffer The location to read the data into
+    //! \param[in] size The size of pdest_buffer
+    //! \returns The amount of data read
+    size_t read_all_raw(byte* pdest_buffer, size_t size) const;
+
+    //! \brief Stream the entire contents of this block to a sink
+    //!
+    //! Child blocks which have not been loaded yet are requested from the
+    //! database context \ref stream_batch_pages at a time, and are not
+    //! cached on this block.
+    //! \param[in] sink Called with each page of data, in order
+    void stream_raw(const byte_sink& sink) const;
     
     uint get_page_count() const;
     std::tr1::shared_ptr<external_block> get_page(uint page_num) const;
@@ -741,6 +938,10 @@ public:
 
     bool is_internal() const { return false; }
 
+    //! \brief Get the data of this block
+    //! \returns A pointer to get_total_size() bytes of data, or 0 if the block is empty
+    const byte* get_buffer() const { return m_buffer.empty() ? 0 : &m_buffer[0]; }
+
 private:
     external_block& operator=(const external_block& other); // = delete
 
@@ -912,6 +1113,40 @@ inline size_t pstsdk::node_impl::read_raw(byte* pdest_buffer, size_t size, ulong
     return ensure_data_block()->read_raw(pdest_buffer, size, offset); 
 }
 
+inline std::vector<pstsdk::byte> pstsdk::node_impl::read_all() const
+{
+    data_block* pdata = ensure_data_block();
+    std::vector<byte> buffer(pdata->get_total_size());
+
+    if(buffer.empty())
+        return buffer;
+
+    if(pdata->is_internal())
+        static_cast<extended_block*>(pdata)->read_all_raw(&buffer[0], buffer.size());
+    else
+        pdata->read_raw(&buffer[0], buffer.size(), 0);
+
+    return buffer;
+}
+
+inline size_t pstsdk::node_impl::stream_to(const byte_sink& sink) const
+{
+    data_block* pdata = ensure_data_block();
+
+    if(pdata->is_internal())
+    {
+        static_cast<extended_block*>(pdata)->stream_raw(sink);
+    }
+    else
+    {
+        external_block* ppage = static_cast<external_block*>(pdata);
+        if(ppage->get_total_size() > 0)
+            sink(ppage->get_buffer(), ppage->get_total_size());
+    }
+
+    return pdata->get_total_size();
+}
+
 template<typename T> 
 inline T pstsdk::node_impl::read(ulong offset) const
 {
@@ -966,6 +1201,9 @@ inline size_t pstsdk::node_impl::resize(size_t size)
 
 inline pstsdk::data_block* pstsdk::node_impl::ensure_data_block() const
 { 
+    if(!m_pdata && m_pcontainer_node)
+        m_pdata = m_pcontainer_node->find_prefetched(m_original_data_id);
+
     if(!m_pdata) 
         m_pdata = m_db->read_data_block(m_original_data_id); 
 
@@ -993,13 +1231,68 @@ inline void pstsdk::block::touch()
 }
 //! \endcond
 
+inline bool pstsdk::node_stream_device::position_cursor()
+{
+    std::tr1::shared_ptr<data_block> pdata = m_pnode->get_data_block();
+
+    if(pdata != m_pdata)
+    {
+        // the node was written to or resized; everything we hold is stale
+        m_pdata = pdata;
+        m_ppage.reset();
+        m_pnext_page.reset();
+        m_page_stride = 0;
+    }
+
+    if(m_ppage && m_pos >= m_page_start && m_pos < m_page_start + static_cast<std::streamsize>(m_ppage->get_total_size()))
+        return true;
+
+    if(m_pos < 0 || static_cast<size_t>(m_pos) >= m_pdata->get_total_size())
+        return false;
+
+    uint page_count = m_pdata->get_page_count();
+
+    if(m_ppage && m_pnext_page && m_pos == m_page_start + static_cast<std::streamsize>(m_ppage->get_total_size()))
+    {
+        // sequential access, step onto the page we already fetched
+        m_page_start += m_ppage->get_total_size();
+        ++m_page_num;
+        m_ppage = m_pnext_page;
+    }
+    else
+    {
+        if(m_page_stride == 0)
+            m_page_stride = (page_count > 1) ? m_pdata->get_page(0)->get_total_size() : m_pdata->get_total_size();
+
+        m_page_num = static_cast<uint>(m_pos / m_page_stride);
+        m_page_start = static_cast<std::streamsize>(m_page_num) * m_page_stride;
+        m_ppage = m_pdata->get_page(m_page_num);
+    }
+
+    if(m_page_num + 1 < page_count)
+        m_pnext_page = m_pdata->get_page(m_page_num + 1);
+    else
+        m_pnext_page.reset();
+
+    return true;
+}
+
 inline std::streamsize pstsdk::node_stream_device::read(char* pbuffer, std::streamsize n)
 {
-    size_t read = m_pnode->read_raw(reinterpret_cast<byte*>(pbuffer), static_cast<size_t>(n), static_cast<size_t>(m_pos));
-    m_pos += read;
+    std::streamsize total_read = 0;
+
+    while(total_read < n && position_cursor())
+    {
+        size_t page_offset = static_cast<size_t>(m_pos - m_page_start);
+        size_t read_size = std::min(static_cast<size_t>(n - total_read), m_ppage->get_total_size() - page_offset);
+
+        read_size = m_ppage->read_raw(reinterpret_cast<byte*>(pbuffer) + total_read, read_size, page_offset);
+        m_pos += read_size;
+        total_read += read_size;
+    }
 
-    if(read)
-        return read;
+    if(total_read)
+        return total_read;
     else
         return -1;
 }
@@ -1009,6 +1302,12 @@ inline std::streamsize pstsdk::node_stream_device::write(const char* pbuffer, st
 {
     size_t written = m_pnode->write_raw(reinterpret_cast<const byte*>(pbuffer), static_cast<size_t>(n), static_cast<size_t>(m_pos));
     m_pos += written;
+
+    // the write may have replaced the blocks under the cursor
+    m_pdata.reset();
+    m_ppage.reset();
+    m_pnext_page.reset();
+
     return written;
 }
 //! \endcond
@@ -1253,6 +1552,107 @@ inline size_t pstsdk::extended_block::read_raw(byte* pdest_buffer, size_t size,
     return total_bytes_read;
 }
 
+inline size_t pstsdk::extended_block::read_all_raw(byte* pdest_buffer, size_t size) const
+{
+    size = std::min(size, get_total_size());
+
+    if(get_level() == 2)
+    {
+        for(uint i = 0; i < m_child_blocks.size() && i * m_child_max_total_size < size; ++i)
+        {
+            size_t pos = i * m_child_max_total_size;
+            static_cast<extended_block*>(get_child_block(i))->read_all_raw(pdest_buffer + pos, std::min(m_child_max_total_size, size - pos));
+        }
+
+        return size;
+    }
+
+    std::vector<block_id> pending_bids;
+    std::vector<size_t> pending_pos;
+
+    // each child is copied into its own slot, and no further than the
+    // end of the destination
+    for(uint i = 0; i < m_child_blocks.size() && i * m_child_max_total_size < size; ++i)
+    {
+        size_t pos = i * m_child_max_total_size;
+
+        if(m_child_blocks[i] || m_block_info[i] == 0)
+        {
+            // already in memory, or a new block which has never been saved
+            data_block* pchild = get_child_block(i);
+            pchild->read_raw(pdest_buffer + pos, std::min(pchild->get_total_size(), std::min(m_child_max_total_size, size - pos)), 0);
+        }
+        else
+        {
+            pending_bids.push_back(m_block_info[i]);
+            pending_pos.push_back(pos);
+        }
+    }
+
+    if(!pending_bids.empty())
+    {
+        std::vector<std::tr1::shared_ptr<external_block> > pages = get_db_ptr()->read_external_blocks(pending_bids);
+
+        for(uint i = 0; i < pages.size(); ++i)
+        {
+            size_t room = std::min(m_child_max_total_size, size - pending_pos[i]);
+            pages[i]->read_raw(pdest_buffer + pending_pos[i], std::min(pages[i]->get_total_size(), room), 0);
+        }
+    }
+
+    return size;
+}
+
+inline void pstsdk::extended_block::stream_raw(const byte_sink& sink) const
+{
+    if(get_level() == 2)
+    {
+        for(uint i = 0; i < m_child_blocks.size(); ++i)
+        {
+            if(m_child_blocks[i] || m_block_info[i] == 0)
+                static_cast<extended_block*>(get_child_block(i))->stream_raw(sink);
+            else
+                get_db_ptr()->read_extended_block(m_block_info[i])->stream_raw(sink);
+        }
+
+        return;
+    }
+
+    std::vector<block_id> pending_bids;
+
+    for(uint i = 0; i <= m_child_blocks.size(); ++i)
+    {
+        bool done = (i == m_child_blocks.size());
+        bool loaded = !done && (m_child_blocks[i] || m_block_info[i] == 0);
+
+        // flush the pending batch before anything which must follow it
+        if(!pending_bids.empty() && (done || loaded || pending_bids.size() == stream_batch_pages))
+        {
+            std::vector<std::tr1::shared_ptr<external_block> > pages = get_db_ptr()->read_external_blocks(pending_bids);
+
+            for(uint j = 0; j < pages.size(); ++j)
+                if(pages[j]->get_total_size() > 0)
+                    sink(pages[j]->get_buffer(), pages[j]->get_total_size());
+
+            pending_bids.clear();
+        }
+
+        if(done)
+            break;
+
+        if(loaded)
+        {
+            external_block* pchild = static_cast<external_block*>(get_child_block(i));
+            if(pchild->get_total_size() > 0)
+                sink(pchild->get_buffer(), pchild->get_total_size());
+        }
+        else
+        {
+            pending_bids.push_back(m_block_info[i]);
+        }
+    }
+}
+
 //! \cond write_api
 inline size_t pstsdk::extended_block::write_raw(const byte* psrc_buffer, size_t size, ulong offset, std::tr1::shared_ptr<data_block>& presult)
 {
@@ -1406,9 +1806,141 @@ inline pstsdk::const_subnodeinfo_iterator pstsdk::node_impl::subnode_info_end()
 
 inline pstsdk::node pstsdk::node_impl::lookup(node_id id) const
 {
+    if(!m_psub_index && ++m_lookup_count > subnode_index_lookup_threshold)
+        build_subnode_index();
+
+    if(m_psub_index)
+        return node(std::tr1::const_pointer_cast<node_impl>(shared_from_this()), m_psub_index->lookup(id));
+
     return node(std::tr1::const_pointer_cast<node_impl>(shared_from_this()), ensure_sub_block()->lookup(id));
 }
 
+inline bool pstsdk::node_impl::subnode_exists(node_id id) const
+{
+    if(get_sub_id() == 0)
+        return false;
+
+    if(!m_psub_index && ++m_lookup_count > subnode_index_lookup_threshold)
+        build_subnode_index();
+
+    if(m_psub_index)
+        return m_psub_index->find(id) != 0;
+
+    return ensure_sub_block()->find(id) != 0;
+}
+
+inline const pstsdk::subnode_index& pstsdk::node_impl::build_subnode_index() const
+{
+    if(!m_psub_index)
+    {
+        const subnode_block* pblock = ensure_sub_block();
+        m_psub_index.reset(new subnode_index(pblock->begin(), pblock->end()));
+    }
+
+    return *m_psub_index;
+}
+
+inline void pstsdk::node_impl::prefetch(const std::vector<node_id>& subnodes) const
+{
+    std::vector<block_id> bids;
+    bool fetch_data = !m_pdata && m_original_data_id != 0 && disk::bid_is_external(m_original_data_id);
+
+    if(fetch_data)
+        bids.push_back(m_original_data_id);
+
+    if(get_sub_id() != 0)
+    {
+        const subnode_index& index = build_subnode_index();
+
+        for(size_t i = 0; i < subnodes.size(); ++i)
+        {
+            const subnode_info* pinfo = index.find(subnodes[i]);
+
+            if(pinfo && pinfo->data_bid != 0 && disk::bid_is_external(pinfo->data_bid) && (!m_pprefetched || m_pprefetched->find(pinfo->data_bid) == m_pprefetched->end()))
+                bids.push_back(pinfo->data_bid);
+        }
+    }
+
+    if(bids.empty())
+        return;
+
+    std::vector<std::tr1::shared_ptr<external_block> > blocks = m_db->read_external_blocks(bids);
+    size_t first = 0;
+
+    if(fetch_data)
+        m_pdata = blocks[first++];
+
+    if(first < blocks.size() && !m_pprefetched)
+        m_pprefetched.reset(new prefetched_blocks);
+
+    for(size_t i = first; i < blocks.size(); ++i)
+        (*m_pprefetched)[bids[i]] = blocks[i];
+}
+
+inline std::tr1::shared_ptr<pstsdk::data_block> pstsdk::node_impl::find_prefetched(block_id bid) const
+{
+    if(m_pprefetched)
+    {
+        prefetched_blocks::const_iterator iter = m_pprefetched->find(bid);
+
+        if(iter != m_pprefetched->end())
+            return iter->second;
+    }
+
+    return std::tr1::shared_ptr<data_block>();
+}
+
+inline pstsdk::subnode_index::subnode_index(const_subnodeinfo_iterator begin, const_subnodeinfo_iterator end)
+: m_count(0)
+{
+    std::vector<subnode_info> infos(begin, end);
+
+    // keep the load factor at or below one half
+    size_t capacity = 8;
+    while(capacity < infos.size() * 2)
+        capacity *= 2;
+
+    subnode_info empty = { 0, 0, 0 };
+    m_slots.assign(capacity, empty);
+
+    for(size_t i = 0; i < infos.size(); ++i)
+    {
+        size_t slot = hash(infos[i].id);
+
+        while(m_slots[slot].id != 0 && m_slots[slot].id != infos[i].id)
+            slot = (slot + 1) & (m_slots.size() - 1);
+
+        if(m_slots[slot].id == 0)
+            ++m_count;
+
+        m_slots[slot] = infos[i];
+    }
+}
+
+inline const pstsdk::subnode_info& pstsdk::subnode_index::lookup(node_id id) const
+{
+    const subnode_info* pinfo = find(id);
+
+    if(!pinfo)
+        throw key_not_found<node_id>(id);
+
+    return *pinfo;
+}
+
+inline const pstsdk::subnode_info* pstsdk::subnode_index::find(node_id id) const
+{
+    if(id != 0)
+    {
+        for(size_t slot = hash(id); m_slots[slot].id != 0; slot = (slot + 1) & (m_slots.size() - 1))
+        {
+            if(m_slots[slot].id == id)
+                return &m_slots[slot];
+        }
+    }
+
+    return 0;
+}
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
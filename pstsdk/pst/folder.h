@@ -12,7 +12,14 @@
 #ifndef PSTSDK_PST_FOLDER_H
 #define PSTSDK_PST_FOLDER_H
 
+#include <string>
+#include <vector>
 #include <algorithm>
+#if __GNUC__
+# include <tr1/unordered_map>
+#else
+# include <unordered_map>
+#endif
 #include <boost/iterator/filter_iterator.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 
@@ -63,6 +70,8 @@ class search_folder
 public:
     //! \brief Message iterator type; a transform iterator over a table row iterator
     typedef boost::transform_iterator<message_transform_row, const_table_row_iter> message_iterator;
+    //! \brief Message summary iterator type; a transform iterator over a table row iterator
+    typedef boost::transform_iterator<message_summary_transform_row, const_table_row_iter> message_summary_iterator;
 
     //! \brief Construct a search folder object
     //! \param[in] db The database pointer
@@ -87,12 +96,31 @@ public:
     //! \returns an iterator at the end position
     message_iterator message_end() const
         { return boost::make_transform_iterator(get_contents_table().end(), message_transform_row(m_db)); }
+    //! \brief Get an iterator to the first message summary in this folder
+    //!
+    //! Summaries are read from the contents table alone; no message is
+    //! opened until \ref message_summary::open_message() is called.
+    //! \returns an iterator positioned on the first message summary in this folder
+    message_summary_iterator message_summary_begin() const
+        { return boost::make_transform_iterator(get_contents_table().begin(), message_summary_transform_row(m_db)); }
+    //! \brief Get the end message summary iterator
+    //! \returns an iterator at the end position
+    message_summary_iterator message_summary_end() const
+        { return boost::make_transform_iterator(get_contents_table().end(), message_summary_transform_row(m_db)); }
 
     // property access
     //! \brief Get the display name of this folder
     //! \returns The name of this folder
     std::wstring get_name() const
         { return m_bag.read_prop<std::wstring>(0x3001); }
+    //! \brief Get the display name of this folder, as UTF-8
+    //! \returns The name of this folder
+    std::string get_name_utf8() const
+        { return m_bag.read_prop_utf8(0x3001); }
+    //! \brief Get the display name of this folder, as UTF-8
+    //! \param[out] out Receives the name of this folder, replacing its contents
+    void get_name_utf8(std::string& out) const
+        { m_bag.read_prop_utf8(0x3001, out); }
     //! \brief Get the number of messages in this folder
     //! \returns The number of messages
     size_t get_message_count() const
@@ -190,6 +218,8 @@ class folder
 public:
     //! \brief Message iterator type; a transform iterator over a table row iterator
     typedef boost::transform_iterator<message_transform_row, const_table_row_iter> message_iterator;
+    //! \brief Message summary iterator type; a transform iterator over a table row iterator
+    typedef boost::transform_iterator<message_summary_transform_row, const_table_row_iter> message_summary_iterator;
     //! \brief Folder iterator type; a transform iterator over a filter iterator over table row iterator
     typedef boost::transform_iterator<folder_transform_row, folder_filter_iterator> folder_iterator;
     //! \brief Search folder iterator type; a transform iterator over a filter iterator over table row iterator
@@ -242,6 +272,12 @@ public:
     //! \copydoc search_folder::message_end()
     message_iterator message_end() const
         { return boost::make_transform_iterator(get_contents_table().end(), message_transform_row(m_db)); }
+    //! \copydoc search_folder::message_summary_begin()
+    message_summary_iterator message_summary_begin() const
+        { return boost::make_transform_iterator(get_contents_table().begin(), message_summary_transform_row(m_db)); }
+    //! \copydoc search_folder::message_summary_end()
+    message_summary_iterator message_summary_end() const
+        { return boost::make_transform_iterator(get_contents_table().end(), message_summary_transform_row(m_db)); }
 
     //! \brief Get an iterator to the first associated message in this folder
     //! \returns an iterator positioned on the first associated message in this folder
@@ -256,6 +292,12 @@ public:
     //! \copydoc search_folder::get_name()
     std::wstring get_name() const
         { return m_bag.read_prop<std::wstring>(0x3001); }
+    //! \copydoc search_folder::get_name_utf8() const
+    std::string get_name_utf8() const
+        { return m_bag.read_prop_utf8(0x3001); }
+    //! \copydoc search_folder::get_name_utf8(std::string&) const
+    void get_name_utf8(std::string& out) const
+        { m_bag.read_prop_utf8(0x3001, out); }
     //! \brief Get the number of sub folders in this folder
     //! \returns The number of subfolders
     size_t get_subfolder_count() const
@@ -306,6 +348,111 @@ private:
     mutable std::tr1::shared_ptr<table> m_hierarchy_table;
 };
 
+//! \brief A folder in a \ref folder_tree
+//! \ingroup pst_folderrelated
+struct folder_tree_entry
+{
+    node_id id;                     //!< The node_id of the folder
+    node_id parent_id;              //!< The node_id of the parent folder, or 0 for the root of the tree
+    std::wstring name;              //!< The display name of the folder
+    std::wstring path;              //!< The escaped names from the root of the tree down to this folder
+    size_t message_count;           //!< The number of messages in the folder
+    size_t unread_count;            //!< The number of unread messages in the folder
+    std::vector<node_id> children;  //!< The sub folders, in hierarchy table order
+};
+
+//! \brief An in memory snapshot of a folder hierarchy
+//!
+//! The snapshot is built once, by walking the hierarchy tables from a root
+//! folder down. Names, counts and parent/child links come straight from the
+//! hierarchy table rows, so no folder property bag is opened. Once built,
+//! lookups by node_id, name or path are answered from hash indexes without
+//! touching the database again.
+//!
+//! A path is the names of the folders from (but not including) the root of
+//! the tree, separated by \ref separator, e.g. "Inbox/Projects/2025". The
+//! root itself has the empty path. Within a path, a separator or \ref escape
+//! which is part of a folder name is preceded by an escape, so a folder 
+//! named "A/B" under "Inbox" has the path "Inbox/A\\/B". Like the hierarchy
+//! tables it is built from, the snapshot is not updated if the store changes.
+//! \sa [MS-PST] 2.4.4.4
+//! \ingroup pst_folderrelated
+class folder_tree
+{
+public:
+    //! \brief The character separating folder names in a path
+    static const wchar_t separator = L'/';
+    //! \brief The character marking the next character of a path as part of a folder name
+    static const wchar_t escape = L'\\';
+
+    //! \brief Escape a folder name for use in a path
+    //! \param[in] name The name of the folder
+    //! \returns The name, with each separator and escape preceded by an escape
+    static std::wstring escape_name(const std::wstring& name);
+
+    //! \brief Build a snapshot of the hierarchy under the given folder
+    //! \param[in] db The database pointer
+    //! \param[in] root The folder to root the tree at
+    folder_tree(const shared_db_ptr& db, node_id root = nid_root_folder);
+
+    //! \brief Get the node_id of the root of the tree
+    //! \returns The node_id of the root folder
+    node_id get_root_id() const
+        { return m_root; }
+    //! \brief Get the number of folders in the tree, including the root
+    //! \returns The folder count
+    size_t size() const
+        { return m_entries.size(); }
+    //! \brief Check if a folder is in the tree
+    //! \param[in] id The node_id of the folder
+    //! \returns true if the folder is in the tree
+    bool exists(node_id id) const
+        { return m_entries.find(id) != m_entries.end(); }
+
+    //! \brief Get the snapshot of a folder
+    //! \throws key_not_found<node_id> If the folder is not in the tree
+    //! \param[in] id The node_id of the folder
+    //! \returns The folder's entry
+    const folder_tree_entry& get_entry(node_id id) const;
+    //! \brief Find a folder by path
+    //!
+    //! Leading and trailing separators are ignored, and an escape may precede
+    //! any character.
+    //! \throws key_not_found<std::wstring> If no folder has that path
+    //! \param[in] path The path of the folder
+    //! \returns The node_id of the folder
+    node_id lookup_path(const std::wstring& path) const;
+    //! \brief Find all folders with a given name
+    //! \throws key_not_found<std::wstring> If no folder has that name
+    //! \param[in] name The name of the folders
+    //! \returns The node_ids of the folders, in node_id order
+    const std::vector<node_id>& lookup_name(const std::wstring& name) const;
+
+    //! \brief Open a folder in the tree
+    //! \throws key_not_found<node_id> If the folder is not in the tree
+    //! \param[in] id The node_id of the folder
+    //! \returns The folder
+    folder open_folder(node_id id) const;
+    //! \brief Open a folder in the tree by path
+    //! \throws key_not_found<std::wstring> If no folder has that path
+    //! \param[in] path The path of the folder
+    //! \returns The folder
+    folder open_path(const std::wstring& path) const
+        { return open_folder(lookup_path(path)); }
+
+private:
+    //! \brief Add the sub folders of a folder, as listed in its hierarchy table
+    //! \param[in] parent The entry of the folder
+    //! \param[out] pending Sub folders which must be visited in turn
+    void add_children(folder_tree_entry& parent, std::vector<node_id>& pending);
+
+    shared_db_ptr m_db;
+    node_id m_root;
+    std::tr1::unordered_map<node_id, folder_tree_entry> m_entries;          //!< Every folder in the tree
+    std::tr1::unordered_map<std::wstring, node_id> m_paths;                 //!< The folder at each path
+    std::tr1::unordered_map<std::wstring, std::vector<node_id> > m_names;   //!< The folders with each name
+};
+
 //! \brief Defines a transform from a node_info to a folder
 //!
 //! Used by the boost iterator library to provide iterators over folder objects
@@ -342,9 +489,9 @@ inline pstsdk::folder::folder(const pstsdk::folder& other)
     if(other.m_contents_table)
         m_contents_table.reset(new table(*other.m_contents_table));
     if(other.m_associated_contents_table)
-        m_contents_table.reset(new table(*other.m_associated_contents_table));
+        m_associated_contents_table.reset(new table(*other.m_associated_contents_table));
     if(other.m_hierarchy_table)
-        m_contents_table.reset(new table(*other.m_hierarchy_table));
+        m_hierarchy_table.reset(new table(*other.m_hierarchy_table));
 }
 
 inline pstsdk::folder pstsdk::folder_transform_row::operator()(const pstsdk::const_table_row& row) const
@@ -365,27 +512,157 @@ inline pstsdk::table& pstsdk::search_folder::get_contents_table()
     return const_cast<table&>(const_cast<const search_folder*>(this)->get_contents_table());
 }
 
+inline pstsdk::folder pstsdk::folder::open_sub_folder(const std::wstring& name)
+{
+    // compare against the name column, rather than opening every sub folder
+    const table& hierarchy = get_hierarchy_table();
+
+    for(ulong i = 0; i < hierarchy.size(); ++i)
+    {
+        const_table_row row = hierarchy[i];
+
+        if(get_nid_type(row.get_row_id()) == nid_type_folder && row.prop_exists(0x3001) && row.read_prop<std::wstring>(0x3001) == name)
+            return folder(m_db, m_db->lookup_node(row.get_row_id()));
+    }
+
+    throw key_not_found<std::wstring>(name);
+}
+
+inline pstsdk::folder_tree::folder_tree(const shared_db_ptr& db, node_id root)
+: m_db(db), m_root(root)
+{
+    folder_tree_entry& entry = m_entries[root];
+    entry.id = root;
+    entry.parent_id = 0;
+
+    property_bag bag(m_db->lookup_node(root));
+    entry.name = bag.prop_exists(0x3001) ? bag.read_prop<std::wstring>(0x3001) : std::wstring();
+    entry.message_count = bag.prop_exists(0x3602) ? bag.read_prop<slong>(0x3602) : 0;
+    entry.unread_count = bag.prop_exists(0x3603) ? bag.read_prop<slong>(0x3603) : 0;
+    m_paths[std::wstring()] = root;
+    m_names[entry.name].push_back(root);
+
+    std::vector<node_id> pending(1, root);
+    while(!pending.empty())
+    {
+        node_id id = pending.back();
+        pending.pop_back();
+        add_children(m_entries[id], pending);
+    }
+
+    for(std::tr1::unordered_map<std::wstring, std::vector<node_id> >::iterator iter = m_names.begin(); iter != m_names.end(); ++iter)
+        std::sort(iter->second.begin(), iter->second.end());
+}
 
-namespace compiler_workarounds
+inline void pstsdk::folder_tree::add_children(folder_tree_entry& parent, std::vector<node_id>& pending)
 {
+    table hierarchy(m_db->lookup_node(make_nid(nid_type_hierarchy_table, get_nid_index(parent.id))));
+
+    for(ulong i = 0; i < hierarchy.size(); ++i)
+    {
+        const_table_row row = hierarchy[i];
+        node_id id = row.get_row_id();
+
+        // search folders have no hierarchy of their own; skip them, as 
+        // folder::sub_folder_begin does. A folder listed twice is skipped
+        // too, so a corrupt hierarchy can't send us around in circles.
+        if(get_nid_type(id) != nid_type_folder || exists(id))
+            continue;
+
+        folder_tree_entry& entry = m_entries[id];
+        entry.id = id;
+        entry.parent_id = parent.id;
+        entry.name = row.prop_exists(0x3001) ? row.read_prop<std::wstring>(0x3001) : std::wstring();
+        entry.path = parent.path.empty() ? escape_name(entry.name) : parent.path + separator + escape_name(entry.name);
+        entry.message_count = row.prop_exists(0x3602) ? row.read_prop<slong>(0x3602) : 0;
+        entry.unread_count = row.prop_exists(0x3603) ? row.read_prop<slong>(0x3603) : 0;
+
+        // the first folder by a path wins, as it would walking the tree
+        m_paths.insert(std::make_pair(entry.path, id));
+        m_names[entry.name].push_back(id);
+        parent.children.push_back(id);
+        pending.push_back(id);
+    }
+}
 
-struct folder_name_equal : public std::unary_function<bool, const pstsdk::folder&>
+inline const pstsdk::folder_tree_entry& pstsdk::folder_tree::get_entry(node_id id) const
 {
-    folder_name_equal(const std::wstring& name) : m_name(name) { }
-    bool operator()(const pstsdk::folder& f) const { return f.get_name() == m_name; }
-    std::wstring m_name;
-};
+    std::tr1::unordered_map<node_id, folder_tree_entry>::const_iterator iter = m_entries.find(id);
 
-} // end namespace compiler_workarounds
+    if(iter == m_entries.end())
+        throw key_not_found<node_id>(id);
 
-inline pstsdk::folder pstsdk::folder::open_sub_folder(const std::wstring& name)
+    return iter->second;
+}
+
+inline std::wstring pstsdk::folder_tree::escape_name(const std::wstring& name)
 {
-    folder_iterator iter = std::find_if(sub_folder_begin(), sub_folder_end(), compiler_workarounds::folder_name_equal(name));
+    std::wstring escaped;
+    escaped.reserve(name.size());
 
-    if(iter != sub_folder_end())
-        return *iter;
+    for(std::wstring::size_type i = 0; i < name.size(); ++i)
+    {
+        if(name[i] == separator || name[i] == escape)
+            escaped += escape;
+        escaped += name[i];
+    }
 
-    throw key_not_found<std::wstring>(name);
+    return escaped;
+}
+
+inline pstsdk::node_id pstsdk::folder_tree::lookup_path(const std::wstring& path) const
+{
+    // split into names, then escape them again the way the tree does
+    std::vector<std::wstring> names(1);
+    for(std::wstring::size_type i = 0; i < path.size(); ++i)
+    {
+        if(path[i] == escape && i + 1 < path.size())
+            names.back() += path[++i];
+        else if(path[i] == separator)
+            names.push_back(std::wstring());
+        else
+            names.back() += path[i];
+    }
+
+    std::vector<std::wstring>::size_type first = 0;
+    std::vector<std::wstring>::size_type last = names.size();
+    while(first < last && names[first].empty())
+        ++first;
+    while(last > first && names[last - 1].empty())
+        --last;
+
+    std::wstring canonical;
+    for(std::vector<std::wstring>::size_type i = first; i < last; ++i)
+    {
+        if(i != first)
+            canonical += separator;
+        canonical += escape_name(names[i]);
+    }
+
+    std::tr1::unordered_map<std::wstring, node_id>::const_iterator iter = m_paths.find(canonical);
+
+    if(iter == m_paths.end())
+        throw key_not_found<std::wstring>(path);
+
+    return iter->second;
+}
+
+inline const std::vector<pstsdk::node_id>& pstsdk::folder_tree::lookup_name(const std::wstring& name) const
+{
+    std::tr1::unordered_map<std::wstring, std::vector<node_id> >::const_iterator iter = m_names.find(name);
+
+    if(iter == m_names.end())
+        throw key_not_found<std::wstring>(name);
+
+    return iter->second;
+}
+
+inline pstsdk::folder pstsdk::folder_tree::open_folder(node_id id) const
+{
+    if(!exists(id))
+        throw key_not_found<node_id>(id);
+
+    return folder(m_db, m_db->lookup_node(id));
 }
 
 inline const pstsdk::table& pstsdk::folder::get_contents_table() const
@@ -10,8 +10,16 @@
 
 #include <functional>
 #include <ostream>
+#include <cerrno>
+#ifdef _MSC_VER
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 #include <boost/iterator/transform_iterator.hpp>
 
+#include "pstsdk/util/util.h"
+
 #include "pstsdk/ndb/database_iface.h"
 #include "pstsdk/ndb/node.h"
 
@@ -25,6 +33,53 @@ namespace pstsdk
 //! \ingroup pst
 
 class message;
+
+//! \brief The size of each buffer used by \ref fd_writer
+//! \ingroup pst_messagerelated
+const size_t fd_writer_buffer_size = 1024 * 1024;
+
+//! \brief Writes data to a file descriptor through large buffers
+//!
+//! Data is accumulated into a buffer of \ref fd_writer_buffer_size bytes, 
+//! which is written out once full. Given a scan_executor, each full buffer
+//! is written by a job on that executor while the writer fills its second
+//! buffer, so at most two buffers are ever in use.
+//! \ingroup pst_messagerelated
+class fd_writer
+{
+public:
+    //! \brief Construct a writer over a file descriptor
+    //! \param[in] fd An open file descriptor, written at its current position
+    //! \param[in] pexecutor If not null, the executor to perform writes on. It
+    //!            must not be running any other jobs.
+    explicit fd_writer(int fd, scan_executor* pexecutor = 0)
+        : m_fd(fd), m_pexecutor(pexecutor), m_current(0), m_fill(0), m_error(0) { }
+    ~fd_writer();
+
+    //! \brief Write data
+    //! \throws write_error If an earlier write to the file descriptor failed
+    //! \param[in] pdata The data to write
+    //! \param[in] size The amount of data to write
+    void write(const byte* pdata, size_t size);
+    //! \brief Write out all buffered data, and wait for it to complete
+    //! \throws write_error If writing to the file descriptor failed
+    void finish();
+
+private:
+    fd_writer(const fd_writer&); // = delete
+    fd_writer& operator=(const fd_writer&); // = delete
+
+    void flush();
+    void write_buffer(uint index, size_t size);
+
+    int m_fd;
+    scan_executor* m_pexecutor;
+    std::vector<byte> m_buffers[2];     //!< The buffer being filled, and the one being written
+    uint m_current;                     //!< Index of the buffer being filled
+    size_t m_fill;                      //!< Amount of data in the buffer being filled
+    int m_error;                        //!< errno of the first failed write, or 0
+};
+
 //! \brief Encapsulates an attachment to a message
 //! 
 //! Attachment objects allow you to query for some basic information about
@@ -56,6 +111,25 @@ public:
     //! \returns A stream device for the attachment data
     hnid_stream_device open_byte_stream()
         { return m_bag.open_prop_stream(0x3701); }
+    //! \brief Write the attachment data to a sink
+    //!
+    //! Unlike get_bytes(), the data is never held in memory all at once; it
+    //! is read and passed to the sink a page at a time.
+    //! \param[in] sink Called with each run of data, in order
+    //! \returns The size of the attachment data
+    size_t write_to(const byte_sink& sink) const
+        { return m_bag.stream_prop(0x3701, sink); }
+    //! \brief Write the attachment data to a file descriptor
+    //! \throws write_error If writing to the file descriptor fails
+    //! \param[in] fd An open file descriptor, written at its current position
+    //! \param[in] pexecutor If not null, writes are performed on this executor
+    //!            while further data is read. See \ref fd_writer.
+    //! \returns The size of the attachment data
+    size_t write_to(int fd, scan_executor* pexecutor = 0) const;
+    //! \brief Write the attachment data to an ostream
+    //! \param[in,out] out The stream to write to
+    //! \returns The size of the attachment data
+    size_t write_to(std::ostream& out) const;
     //! \brief Read the size of this attachment
     //!
     //! The size returned here includes metadata, and as such will be
@@ -113,8 +187,7 @@ private:
 //! \ingroup pst_messagerelated
 inline std::ostream& operator<<(std::ostream& out, const attachment& attach)
 {
-    std::vector<byte> data = attach.get_bytes();
-    out.write(reinterpret_cast<char*>(&data[0]), data.size());
+    attach.write_to(out);
     return out;
 }
 
@@ -157,6 +230,14 @@ public:
     //! \returns The recipient name
     std::wstring get_name() const
         { return m_row.read_prop<std::wstring>(0x3001); }
+    //! \brief Get the display name of this recipient, as UTF-8
+    //! \returns The recipient name
+    std::string get_name_utf8() const
+        { return m_row.read_prop_utf8(0x3001); }
+    //! \brief Get the display name of this recipient, as UTF-8
+    //! \param[out] out Receives the recipient name, replacing its contents
+    void get_name_utf8(std::string& out) const
+        { m_row.read_prop_utf8(0x3001, out); }
     //! \brief Get the type of this recipient
     //! \returns The recipient type
     recipient_type get_type() const
@@ -165,10 +246,26 @@ public:
     //! \returns The address type
     std::wstring get_address_type() const
         { return m_row.read_prop<std::wstring>(0x3002); }
+    //! \brief Get the address type of the recipient, as UTF-8
+    //! \returns The address type
+    std::string get_address_type_utf8() const
+        { return m_row.read_prop_utf8(0x3002); }
+    //! \brief Get the address type of the recipient, as UTF-8
+    //! \param[out] out Receives the address type, replacing its contents
+    void get_address_type_utf8(std::string& out) const
+        { m_row.read_prop_utf8(0x3002, out); }
     //! \brief Get the email address of the recipient
     //! \returns The email address
     std::wstring get_email_address() const
         { return m_row.read_prop<std::wstring>(0x39fe); }
+    //! \brief Get the email address of the recipient, as UTF-8
+    //! \returns The email address
+    std::string get_email_address_utf8() const
+        { return m_row.read_prop_utf8(0x39fe); }
+    //! \brief Get the email address of the recipient, as UTF-8
+    //! \param[out] out Receives the email address, replacing its contents
+    void get_email_address_utf8(std::string& out) const
+        { m_row.read_prop_utf8(0x39fe, out); }
     //! \brief Checks to see if this recipient has an email address
     //! \returns true if get_email_address() doesn't throw
     bool has_email_address() const
@@ -177,6 +274,14 @@ public:
     //! \returns The account name
     std::wstring get_account_name() const
         { return m_row.read_prop<std::wstring>(0x3a00); }
+    //! \brief Get the name of the recipients account, as UTF-8
+    //! \returns The account name
+    std::string get_account_name_utf8() const
+        { return m_row.read_prop_utf8(0x3a00); }
+    //! \brief Get the name of the recipients account, as UTF-8
+    //! \param[out] out Receives the account name, replacing its contents
+    void get_account_name_utf8(std::string& out) const
+        { m_row.read_prop_utf8(0x3a00, out); }
     //! \brief Checks to see if this recipient has an account name
     //! \returns true if get_account_name() doesn't throw
     bool has_account_name() const
@@ -210,6 +315,73 @@ struct recipient_transform : public std::unary_function<const_table_row, recipie
         { return recipient(row); }
 };
 
+//! \brief Defines a stream device which decompresses an RTF body
+//!
+//! The RTF body of a message is stored in PR_RTF_COMPRESSED, usually 
+//! compressed with the LZFu algorithm. This device wraps a stream over that
+//! property and decompresses it as it is read, so neither the compressed nor
+//! the decompressed body is ever held in memory in full.
+//!
+//! The CRC of the compressed data is checked once the end of the stream is
+//! reached.
+//! \sa [MS-OXRTFCP]
+//! \ingroup pst_messagerelated
+class rtf_stream_device : public boost::iostreams::device<boost::iostreams::input>
+{
+public:
+    //! \brief Construct the device over a stream of compressed RTF
+    //! \throws database_corrupt If the compressed RTF header is invalid
+    //! \param[in] compressed A stream over the PR_RTF_COMPRESSED property
+    explicit rtf_stream_device(const hnid_stream_device& compressed);
+
+    //! \brief Read decompressed RTF into the buffer
+    //! \throws database_corrupt If the compressed data is truncated, or its CRC does not match
+    //! \param[out] pbuffer The buffer to store the results into
+    //! \param[in] n The amount of data to read
+    //! \returns The amount of data read, or -1 at the end of the stream
+    std::streamsize read(char* pbuffer, std::streamsize n);
+
+    //! \brief Get the size of the decompressed RTF, as recorded in the header
+    //! \returns The decompressed size
+    size_t get_raw_size() const { return m_raw_size; }
+    //! \brief Check if the RTF is stored compressed
+    //! \returns false if the RTF is stored uncompressed ("MELA")
+    bool is_compressed() const { return m_compressed; }
+
+private:
+    static const ulong compressed_signature = 0x75465a4c;     //!< "LZFu"
+    static const ulong uncompressed_signature = 0x414c454d;   //!< "MELA"
+    static const uint dictionary_size = 4096;
+    static const uint input_buffer_size = 4096;
+
+    bool next_input(byte& b);
+    void output(byte b, char* pbuffer, std::streamsize& produced);
+    void finish();
+
+    hnid_stream_device m_source;
+    std::vector<byte> m_input;          //!< Compressed data read from m_source
+    size_t m_input_pos;                 //!< Next unread byte in m_input
+    size_t m_input_end;                 //!< End of the data in m_input
+    ulong m_remaining;                  //!< Compressed bytes not yet read from m_source
+    ulong m_raw_size;
+    bool m_compressed;
+    ulong m_crc;                        //!< CRC of the compressed data read so far
+    ulong m_expected_crc;
+
+    std::vector<byte> m_dictionary;     //!< The LZFu sliding window
+    uint m_write_pos;                   //!< Where the next output byte goes in m_dictionary
+    byte m_control;                     //!< Remaining bits of the current control byte
+    uint m_control_bits;                //!< Number of bits remaining in m_control
+    uint m_ref_pos;                     //!< Next byte to copy from the dictionary
+    uint m_ref_remaining;               //!< Bytes left to copy from the dictionary
+    bool m_done;
+};
+
+//! \brief The decompressed RTF stream, defined using the boost iostream 
+//! library and the \ref rtf_stream_device.
+//! \ingroup pst_messagerelated
+typedef boost::iostreams::stream<rtf_stream_device> rtf_stream;
+
 //! \brief Represents a message in a PST file
 //!
 //! A message is the basic abstraction exposed by MAPI - everything is a
@@ -232,6 +404,15 @@ public:
     //! \param[in] n A message node
     explicit message(const node& n)
         : m_bag(n) { }
+    //! \brief Construct a message object, optionally prefetching
+    //!
+    //! When prefetch is set, the structures this message depends on are
+    //! read as one batch (see \ref prefetch()) before any of them is used,
+    //! including the property context read by this constructor.
+    //! \param[in] n A message node
+    //! \param[in] prefetch true to prefetch the message's structures
+    message(const node& n, bool prefetch)
+        : m_bag(prefetch ? prefetch_node(n) : n) { }
     message(const message& other);
 
 #ifndef BOOST_NO_RVALUE_REFERENCES
@@ -261,6 +442,13 @@ public:
     //! \brief Get the subject of this message
     //! \returns The message subject
     std::wstring get_subject() const;
+    //! \brief Get the subject of this message, as UTF-8
+    //! \returns The message subject
+    std::string get_subject_utf8() const
+        { std::string out; get_subject_utf8(out); return out; }
+    //! \brief Get the subject of this message, as UTF-8
+    //! \param[out] out Receives the message subject, replacing its contents
+    void get_subject_utf8(std::string& out) const;
     //! \brief Check to see if a subject is set on this message
     //! \returns true if a subject is set on this message
     bool has_subject() const
@@ -311,6 +499,22 @@ public:
     //! \returns true if the HTML body property exists
     bool has_html_body() const
         { return m_bag.prop_exists(0x1013); }
+    //! \brief Get the RTF body of this message
+    //!
+    //! The RTF body is decompressed as it is read. The returned stream device
+    //! can be used to construct a proper stream:
+    //! \code
+    //! message m = ...;
+    //! rtf_stream rtfbody(m.open_rtf_body_stream());
+    //! \endcode
+    //! \throws database_corrupt If the compressed RTF header is invalid
+    //! \returns The RTF body as a stream
+    rtf_stream_device open_rtf_body_stream()
+        { return rtf_stream_device(m_bag.open_prop_stream(0x1009)); }
+    //! \brief Checks to see if this message has an RTF body
+    //! \returns true if the compressed RTF property exists
+    bool has_rtf_body() const
+        { return m_bag.prop_exists(0x1009); }
     // \brief Get the total size of this message
     //! \returns The message size
     size_t size() const
@@ -346,14 +550,124 @@ public:
     node_id get_id() const
         { return m_bag.get_node().get_id(); }
 
+    //! \brief Read the structures this message depends on in one batch
+    //!
+    //! Fetches the data blocks of the property context, the recipient and
+    //! attachment tables, and the subnodes holding large property values 
+    //! (such as the body) together, rather than as each is first used.
+    //! Attachments themselves are not prefetched.
+    //! \sa node::prefetch
+    void prefetch() const
+        { prefetch_node(m_bag.get_node()); }
+
 private:
     message& operator=(const message&); // = delete
+    friend class message_summary;
+
+    //! \brief Prefetch the structures of a message node
+    //! \param[in] n A message node
+    //! \returns n
+    static const node& prefetch_node(const node& n);
+
+    //! \brief Strip the prefix marker from a subject, if present
+    //! \param[in] subject The subject, as stored
+    //! \returns The subject, as displayed
+    static std::wstring strip_subject_prefix(const std::wstring& subject);
 
     property_bag m_bag;
     mutable std::tr1::shared_ptr<table> m_attachment_table;
     mutable std::tr1::shared_ptr<table> m_recipient_table;
 };
 
+//! \brief A lightweight summary of a message, read from a contents table row
+//!
+//! Listing a folder usually needs only a handful of properties per message,
+//! all of which the contents table already has as columns. A 
+//! message_summary answers from the row alone, without opening the 
+//! message's node or property context; open_message() promotes it to a full
+//! \ref message when more is needed.
+//!
+//! The contents table is a cached view of its messages, so a summary can
+//! disagree with the message itself (the size, for example, is not always
+//! kept up to date).
+//! \sa [MS-PST] 2.4.4.5
+//! \ingroup pst_messagerelated
+class message_summary
+{
+public:
+    //! \brief Construct a message summary
+    //! \param[in] db The database pointer
+    //! \param[in] row A row from a contents table
+    message_summary(const shared_db_ptr& db, const const_table_row& row)
+        : m_db(db), m_row(row) { }
+
+    // property access
+    //! \copydoc message::get_subject()
+    std::wstring get_subject() const
+        { return message::strip_subject_prefix(m_row.read_prop<std::wstring>(0x37)); }
+    //! \copydoc message::has_subject()
+    bool has_subject() const
+        { return m_row.prop_exists(0x37); }
+    //! \brief Get the display name of the sender, as represented
+    //! \returns The sender name
+    std::wstring get_sender_name() const
+        { return m_row.read_prop<std::wstring>(0x42); }
+    //! \brief Checks to see if a sender name is set on this message
+    //! \returns true if get_sender_name() doesn't throw
+    bool has_sender_name() const
+        { return m_row.prop_exists(0x42); }
+    //! \brief Get the time this message was delivered
+    //! \returns The delivery time
+    time_t get_delivery_time() const
+        { return filetime_to_time_t(m_row.read_prop<ulonglong>(0xe06)); }
+    //! \brief Checks to see if a delivery time is set on this message
+    //! \returns true if get_delivery_time() doesn't throw
+    bool has_delivery_time() const
+        { return m_row.prop_exists(0xe06); }
+    //! \brief Get the message flags
+    //! \returns The message flags, PidTagMessageFlags
+    ulong get_flags() const
+        { return m_row.read_prop<ulong>(0xe07); }
+    //! \copydoc message::size()
+    size_t size() const
+        { return m_row.read_prop<slong>(0xe08); }
+
+    //! \brief Open the full message this summary describes
+    //! \returns The message
+    message open_message() const
+        { return message(m_db->lookup_node(get_id())); }
+
+    // lower layer access
+    //! \brief Get the contents table row underlying this summary
+    //! \returns The property row
+    const const_table_row& get_property_row() const
+        { return m_row; }
+    //! \brief Get the node_id of this message
+    //! \returns The node_id of the message
+    node_id get_id() const
+        { return m_row.get_row_id(); }
+
+private:
+    shared_db_ptr m_db;
+    const_table_row m_row;
+};
+
+//! \brief Defines a transform from a row of a contents table to a message_summary
+//!
+//! Used by the boost iterator library to provide iterators over message summaries
+//! \ingroup pst_messagerelated
+class message_summary_transform_row : public std::unary_function<const_table_row, message_summary>
+{
+public:
+    message_summary_transform_row(const shared_db_ptr& db) 
+        : m_db(db) { }
+    message_summary operator()(const const_table_row& row) const
+        { return message_summary(m_db, row); }
+
+private:
+    shared_db_ptr m_db;
+};
+
 class message_transform_row : public std::unary_function<const_table_row, message>
 {
 public:
@@ -380,18 +694,308 @@ private:
 
 } // end namespace pstsdk
 
-inline std::wstring pstsdk::attachment::get_filename() const
+inline pstsdk::fd_writer::~fd_writer()
 {
-    try
+    // a queued write still refers to this object
+    if(m_pexecutor)
     {
-        return m_bag.read_prop<std::wstring>(0x3707);
-    } 
-    catch(key_not_found<prop_id>&)
+        try
+        {
+            m_pexecutor->wait();
+        }
+        catch(...)
+        {
+        }
+    }
+}
+
+inline void pstsdk::fd_writer::write(const byte* pdata, size_t size)
+{
+    while(size > 0)
     {
-        return m_bag.read_prop<std::wstring>(0x3704);
+        std::vector<byte>& buffer = m_buffers[m_current];
+        if(buffer.empty())
+            buffer.resize(fd_writer_buffer_size);
+
+        size_t amount = std::min(size, buffer.size() - m_fill);
+        memcpy(&buffer[m_fill], pdata, amount);
+
+        m_fill += amount;
+        pdata += amount;
+        size -= amount;
+
+        if(m_fill == buffer.size())
+            flush();
     }
 }
 
+inline void pstsdk::fd_writer::finish()
+{
+    flush();
+
+    if(m_pexecutor)
+        m_pexecutor->wait();
+
+    if(m_error != 0)
+        throw write_error("write failed");
+}
+
+inline void pstsdk::fd_writer::flush()
+{
+    if(m_fill == 0)
+        return;
+
+    if(m_pexecutor)
+    {
+        // the other buffer must be written before this one, and is reused next.
+        // m_error belongs to the queued write until it has been waited on.
+        m_pexecutor->wait();
+
+        if(m_error != 0)
+            throw write_error("write failed");
+
+        m_pexecutor->submit(std::tr1::bind(&fd_writer::write_buffer, this, m_current, m_fill));
+        m_current = 1 - m_current;
+        m_fill = 0;
+    }
+    else
+    {
+        write_buffer(m_current, m_fill);
+        m_fill = 0;
+
+        if(m_error != 0)
+            throw write_error("write failed");
+    }
+}
+
+inline void pstsdk::fd_writer::write_buffer(uint index, size_t size)
+{
+    const byte* pdata = &m_buffers[index][0];
+
+    while(size > 0 && m_error == 0)
+    {
+#ifdef _MSC_VER
+        int written = _write(m_fd, pdata, static_cast<unsigned int>(size));
+#else
+        ssize_t written = ::write(m_fd, pdata, size);
+#endif
+        if(written < 0)
+        {
+            if(errno != EINTR)
+                m_error = errno;
+            continue;
+        }
+
+        pdata += written;
+        size -= written;
+    }
+}
+
+namespace compiler_workarounds
+{
+
+struct fd_writer_sink
+{
+    fd_writer_sink(pstsdk::fd_writer& writer) : m_pwriter(&writer) { }
+    void operator()(const pstsdk::byte* pdata, size_t size) const
+        { m_pwriter->write(pdata, size); }
+    pstsdk::fd_writer* m_pwriter;
+};
+
+struct ostream_sink
+{
+    ostream_sink(std::ostream& out) : m_pout(&out) { }
+    void operator()(const pstsdk::byte* pdata, size_t size) const
+        { m_pout->write(reinterpret_cast<const char*>(pdata), size); }
+    std::ostream* m_pout;
+};
+
+} // end namespace compiler_workarounds
+
+inline size_t pstsdk::attachment::write_to(int fd, scan_executor* pexecutor) const
+{
+    fd_writer writer(fd, pexecutor);
+    size_t size = write_to(byte_sink(compiler_workarounds::fd_writer_sink(writer)));
+    writer.finish();
+
+    return size;
+}
+
+inline size_t pstsdk::attachment::write_to(std::ostream& out) const
+{
+    return write_to(byte_sink(compiler_workarounds::ostream_sink(out)));
+}
+
+inline pstsdk::rtf_stream_device::rtf_stream_device(const hnid_stream_device& compressed)
+: m_source(compressed), m_input(input_buffer_size), m_input_pos(0), m_input_end(0), m_remaining(0), m_crc(0),
+  m_dictionary(dictionary_size), m_control(0), m_control_bits(0), m_ref_pos(0), m_ref_remaining(0), m_done(false)
+{
+    // the dictionary starts out holding these common RTF tokens
+    static const char prefix[] = 
+        "{\\rtf1\\ansi\\mac\\deff0\\deftab720{\\fonttbl;}{\\f0\\fnil \\froman "
+        "\\fswiss \\fmodern \\fscript \\fdecor MS Sans SerifSymbolArialTimes New RomanCourier"
+        "{\\colortbl\\red0\\green0\\blue0\r\n\\par \\pard\\plain\\f0\\fs20\\b\\i\\u\\tab\\tx";
+
+    m_write_pos = sizeof(prefix) - 1;
+    memcpy(&m_dictionary[0], prefix, m_write_pos);
+
+    // COMPSIZE, RAWSIZE, COMPTYPE, CRC
+    ulong header[4];
+    char* pheader = reinterpret_cast<char*>(header);
+    std::streamsize read = 0;
+    while(read < static_cast<std::streamsize>(sizeof(header)))
+    {
+        std::streamsize result = m_source.read(pheader + read, sizeof(header) - read);
+        if(result <= 0)
+            throw database_corrupt("compressed RTF header truncated");
+        read += result;
+    }
+
+    if(header[2] == compressed_signature)
+        m_compressed = true;
+    else if(header[2] == uncompressed_signature)
+        m_compressed = false;
+    else
+        throw database_corrupt("unknown compressed RTF type");
+
+    // COMPSIZE counts everything after itself
+    if(header[0] < sizeof(header) - sizeof(ulong))
+        throw database_corrupt("invalid compressed RTF size");
+
+    m_remaining = header[0] - (sizeof(header) - sizeof(ulong));
+    m_raw_size = header[1];
+    m_expected_crc = header[3];
+}
+
+inline std::streamsize pstsdk::rtf_stream_device::read(char* pbuffer, std::streamsize n)
+{
+    std::streamsize produced = 0;
+
+    while(produced < n && !m_done)
+    {
+        if(!m_compressed)
+        {
+            byte b;
+            if(!next_input(b))
+                m_done = true;
+            else
+                pbuffer[produced++] = static_cast<char>(b);
+            continue;
+        }
+
+        if(m_ref_remaining > 0)
+        {
+            byte b = m_dictionary[m_ref_pos];
+            m_ref_pos = (m_ref_pos + 1) % dictionary_size;
+            --m_ref_remaining;
+            output(b, pbuffer, produced);
+            continue;
+        }
+
+        if(m_control_bits == 0)
+        {
+            if(!next_input(m_control))
+            {
+                finish();
+                break;
+            }
+            m_control_bits = 8;
+        }
+
+        bool is_reference = (m_control & 1) != 0;
+        m_control >>= 1;
+        --m_control_bits;
+
+        if(!is_reference)
+        {
+            byte b;
+            if(!next_input(b))
+            {
+                finish();
+                break;
+            }
+            output(b, pbuffer, produced);
+        }
+        else
+        {
+            // 12 bit dictionary offset, 4 bit length (minus two), big endian
+            byte high, low;
+            if(!next_input(high) || !next_input(low))
+            {
+                finish();
+                break;
+            }
+
+            uint offset = (static_cast<uint>(high) << 4) | (low >> 4);
+            if(offset == m_write_pos)
+            {
+                finish();
+                break;
+            }
+
+            m_ref_pos = offset;
+            m_ref_remaining = (low & 0xf) + 2;
+        }
+    }
+
+    if(produced)
+        return produced;
+    else
+        return -1;
+}
+
+inline bool pstsdk::rtf_stream_device::next_input(byte& b)
+{
+    if(m_input_pos == m_input_end)
+    {
+        if(m_remaining == 0)
+            return false;
+
+        std::streamsize want = std::min<ulong>(m_remaining, m_input.size());
+        std::streamsize got = m_source.read(reinterpret_cast<char*>(&m_input[0]), want);
+        if(got <= 0)
+            throw database_corrupt("compressed RTF truncated");
+
+        m_crc = disk::compute_crc(&m_input[0], static_cast<ulong>(got), m_crc);
+        m_remaining -= static_cast<ulong>(got);
+        m_input_pos = 0;
+        m_input_end = static_cast<size_t>(got);
+    }
+
+    b = m_input[m_input_pos++];
+    return true;
+}
+
+inline void pstsdk::rtf_stream_device::output(byte b, char* pbuffer, std::streamsize& produced)
+{
+    pbuffer[produced++] = static_cast<char>(b);
+    m_dictionary[m_write_pos] = b;
+    m_write_pos = (m_write_pos + 1) % dictionary_size;
+}
+
+inline void pstsdk::rtf_stream_device::finish()
+{
+    m_done = true;
+
+    // the CRC covers everything after the header, including any padding
+    // following the end marker
+    m_input_pos = m_input_end;
+    byte b;
+    while(next_input(b))
+        m_input_pos = m_input_end;
+
+    if(m_crc != m_expected_crc)
+        throw database_corrupt("compressed RTF CRC mismatch");
+}
+
+inline std::wstring pstsdk::attachment::get_filename() const
+{
+    if(m_bag.prop_exists(0x3707))
+        return m_bag.read_prop<std::wstring>(0x3707);
+
+    return m_bag.read_prop<std::wstring>(0x3704);
+}
+
 inline pstsdk::message pstsdk::attachment::open_as_message() const
 {
     if(!is_message()) 
@@ -440,32 +1044,66 @@ inline pstsdk::table& pstsdk::message::get_recipient_table()
 
 inline size_t pstsdk::message::get_attachment_count() const
 {
-    size_t count = 0;
-    try 
-    {
-        count = get_attachment_table().size();
-    } 
-    catch (const key_not_found<node_id>&) { }
+    // most messages have no attachments; don't throw to find that out
+    if(!m_attachment_table && !m_bag.get_node().subnode_exists(nid_attachment_table))
+        return 0;
 
-    return count;
+    return get_attachment_table().size();
 }
 
 inline size_t pstsdk::message::get_recipient_count() const
 {
-    size_t count = 0;
-    try
-    {
-        count = get_recipient_table().size();
-    }
-    catch (const key_not_found<node_id>&) { }
+    if(!m_recipient_table && !m_bag.get_node().subnode_exists(nid_recipient_table))
+        return 0;
 
-    return count;
+    return get_recipient_table().size();
 }
 
 inline std::wstring pstsdk::message::get_subject() const
 {
-    std::wstring buffer = m_bag.read_prop<std::wstring>(0x37);
+    return strip_subject_prefix(m_bag.read_prop<std::wstring>(0x37));
+}
+
+inline void pstsdk::message::get_subject_utf8(std::string& out) const
+{
+    std::vector<byte> buffer = m_bag.read_prop<std::vector<byte> >(0x37);
+    size_t char_size = (m_bag.get_prop_type(0x37) == prop_type_string) ? 1 : 2;
+    size_t skip = 0;
+
+    // the same two characters strip_subject_prefix skips
+    if(buffer.size() >= char_size && buffer[0] == message_subject_prefix_lead_byte && (char_size == 1 || buffer[1] == 0))
+        skip = std::min(buffer.size(), 2 * char_size);
 
+    const byte* pbytes = buffer.empty() ? 0 : &buffer[0] + skip;
+
+    if(char_size == 1)
+        latin1_to_utf8(pbytes, buffer.size() - skip, out);
+    else
+        utf16le_to_utf8(pbytes, buffer.size() - skip, out);
+}
+
+inline const pstsdk::node& pstsdk::message::prefetch_node(const node& n)
+{
+    std::vector<node_id> subnodes;
+    subnodes.push_back(nid_recipient_table);
+    subnodes.push_back(nid_attachment_table);
+
+    // large property values live in subnodes of type ltp
+    if(n.get_sub_id() != 0)
+    {
+        for(const_subnodeinfo_iterator iter = n.subnode_info_begin(); iter != n.subnode_info_end(); ++iter)
+        {
+            if(get_nid_type(iter->id) == nid_type_ltp)
+                subnodes.push_back(iter->id);
+        }
+    }
+
+    n.prefetch(subnodes);
+    return n;
+}
+
+inline std::wstring pstsdk::message::strip_subject_prefix(const std::wstring& buffer)
+{
     if(buffer.size() && buffer[0] == message_subject_prefix_lead_byte)
     {
         // Skip the second chracter as well
@@ -13,8 +13,15 @@
 #ifndef PSTSDK_PST_PST_H
 #define PSTSDK_PST_PST_H
 
+#include <string>
+#include <vector>
+#include <algorithm>
+#if __GNUC__
+# include <tr1/functional>
+#else
+# include <functional>
+#endif
 #include <boost/noncopyable.hpp>
-#include <boost/iterator/filter_iterator.hpp>
 #include <boost/iterator/transform_iterator.hpp>
 
 #include "pstsdk/ndb/database.h"
@@ -33,6 +40,14 @@ namespace pstsdk
 //! \defgroup pst_pstrelated PST
 //! \ingroup pst
 
+//! \brief The number of messages handed to each job of a parallel traversal
+//! \ingroup pst_pstrelated
+const size_t pst_messages_per_job = 32;
+
+//! \brief The number of parallel traversal jobs submitted before waiting on the executor
+//! \ingroup pst_pstrelated
+const size_t pst_jobs_in_flight = 16;
+
 //! \brief A PST file
 //!
 //! pst represents a pst file on disk. Both OST and PST files are supported,
@@ -43,48 +58,103 @@ namespace pstsdk
 //! - opening the root folder
 //! - opening a specific folder by name
 //! - performing named property lookups
+//!
+//! The first time nodes of a given type are enumerated or counted, the 
+//! NBT is walked once and the node_infos are bucketed by \ref nid_type.
+//! After that, folder and message iteration (and counts) are scans of
+//! a sorted in memory array rather than of every NBT leaf, and the
+//! database is given a node filter so lookups of missing nodes fail fast.
 //! \ingroup pst_pstrelated
 class pst : private boost::noncopyable
 {
-    typedef boost::filter_iterator<is_nid_type<nid_type_folder>, const_nodeinfo_iterator> folder_filter_iterator;
-    typedef boost::filter_iterator<is_nid_type<nid_type_message>, const_nodeinfo_iterator> message_filter_iterator;
-
 public:
-    //! \brief Message iterator type; a transform iterator over a filter iterator over a nodeinfo iterator
-    typedef boost::transform_iterator<message_transform_info, message_filter_iterator> message_iterator;
-    //! \brief Folder iterator type; a transform iterator over a filter iterator over a nodeinfo iterator
-    typedef boost::transform_iterator<folder_transform_info, folder_filter_iterator> folder_iterator;
+    //! \brief Iterator over the node_infos of one nid_type, in node_id order
+    typedef std::vector<node_info>::const_iterator node_info_iterator;
+    //! \brief Message iterator type; a transform iterator over a node_info_iterator
+    typedef boost::transform_iterator<message_transform_info, node_info_iterator> message_iterator;
+    //! \brief Folder iterator type; a transform iterator over a node_info_iterator
+    typedef boost::transform_iterator<folder_transform_info, node_info_iterator> folder_iterator;
 
     //! \brief Construct a pst object from the specified file
     //! \param[in] filename The pst file to open on disk
     pst(const std::wstring& filename) 
-        : m_db(open_database(filename)) { }
+        : m_filename(filename), m_db(open_database(filename)) { }
 
 #ifndef BOOST_NO_RVALUE_REFERENCES
     //! \brief Move constructor
     //! \param[in] other The other pst file
     pst(pst&& other)
-        : m_db(std::move(other.m_db)), m_bag(std::move(other.m_bag)), m_map(std::move(other.m_map)) { }
+        : m_filename(std::move(other.m_filename)), m_db(std::move(other.m_db)), m_bag(std::move(other.m_bag)), m_map(std::move(other.m_map)), m_nodes(std::move(other.m_nodes)), m_tree(std::move(other.m_tree)) { }
 #endif
 
     // subobject discovery/enumeration
     //! \brief Get an iterator to the first folder in the PST file
     //! \returns an iterator positioned on the first folder in this PST file
     folder_iterator folder_begin() const
-        { return boost::make_transform_iterator(boost::make_filter_iterator<is_nid_type<nid_type_folder> >(m_db->read_nbt_root()->begin(), m_db->read_nbt_root()->end()), folder_transform_info(m_db) ); }
+        { return boost::make_transform_iterator(get_nodes(nid_type_folder).begin(), folder_transform_info(m_db) ); }
     //! \brief Get the end folder iterator
     //! \returns an iterator at the end position
     folder_iterator folder_end() const
-        { return boost::make_transform_iterator(boost::make_filter_iterator<is_nid_type<nid_type_folder> >(m_db->read_nbt_root()->end(), m_db->read_nbt_root()->end()), folder_transform_info(m_db) ); }
+        { return boost::make_transform_iterator(get_nodes(nid_type_folder).end(), folder_transform_info(m_db) ); }
+    //! \brief Get the number of folders in the PST file
+    //! \returns The folder count
+    size_t get_folder_count() const
+        { return get_nodes(nid_type_folder).size(); }
 
     //! \brief Get an iterator to the first message in the PST file
     //! \returns an iterator positioned on the first message in this PST file
     message_iterator message_begin() const
-        { return boost::make_transform_iterator(boost::make_filter_iterator<is_nid_type<nid_type_message> >(m_db->read_nbt_root()->begin(), m_db->read_nbt_root()->end()), message_transform_info(m_db) ); }
+        { return boost::make_transform_iterator(get_nodes(nid_type_message).begin(), message_transform_info(m_db) ); }
     //! \brief Get the end message iterator
     //! \returns an iterator at the end position
     message_iterator message_end() const
-        { return boost::make_transform_iterator(boost::make_filter_iterator<is_nid_type<nid_type_message> >(m_db->read_nbt_root()->end(), m_db->read_nbt_root()->end()), message_transform_info(m_db) ); }
+        { return boost::make_transform_iterator(get_nodes(nid_type_message).end(), message_transform_info(m_db) ); }
+    //! \brief Get the number of messages in the PST file
+    //! \returns The message count
+    size_t get_message_count() const
+        { return get_nodes(nid_type_message).size(); }
+
+    //! \brief Get all nodes of a given type in this file
+    //!
+    //! The first call walks the NBT and builds the per type index; every
+    //! later call, for any type, is answered from memory.
+    //! \param[in] type The nid_type to get the nodes of
+    //! \returns The node_infos of that type, sorted by node_id
+    const std::vector<node_info>& get_nodes(nid_type type) const;
+
+    //! \brief Get a snapshot of the folder hierarchy under the root folder
+    //!
+    //! The snapshot is built on first use and kept for the life of this 
+    //! object.
+    //! \returns The folder tree
+    const folder_tree& get_folder_tree() const;
+
+    // parallel traversal
+    //! \brief Process every message in this file, in parallel
+    //!
+    //! The messages are split into jobs of \ref pst_messages_per_job 
+    //! messages, and at most \ref pst_jobs_in_flight jobs are submitted
+    //! before waiting on the executor. Each worker of the executor opens its
+    //! own handle on the file the first time it runs a job, and reuses it for
+    //! the rest of the traversal, so workers share no database state.
+    //! process is called concurrently and in no particular order.
+    //! \param[in] process Called once per message, on whichever thread runs the job
+    //! \param[in] executor Runs the jobs
+    void for_each_message(const std::tr1::function<void (const message&)>& process, scan_executor& executor) const;
+
+    //! \brief Transform every message in this file in parallel, consuming the results in order
+    //!
+    //! transform is run exactly as process is in for_each_message. Once each
+    //! batch of jobs has finished, consume is called on the calling thread
+    //! with that batch's results in node_id order. At most 
+    //! pst_messages_per_job * pst_jobs_in_flight results are held at once.
+    //! \tparam Result The result of transforming a message. Must be default
+    //! constructible and assignable.
+    //! \param[in] transform Called once per message, on whichever thread runs the job
+    //! \param[in] consume Called once per message with the node_id and result, on the calling thread
+    //! \param[in] executor Runs the jobs
+    template<typename Result>
+    void transform_messages(const std::tr1::function<Result (const message&)>& transform, const std::tr1::function<void (node_id, const Result&)>& consume, scan_executor& executor) const;
 
     //! \brief Opens the root folder of this file
     //! \note This is specific to PST files, as an OST file has a different root folder
@@ -92,6 +162,11 @@ public:
     folder open_root_folder() const
         { return folder(m_db, m_db->lookup_node(nid_root_folder)); }
     //! \brief Open a specific folder in this file
+    //!
+    //! The folder is found through the folder tree snapshot. If no folder 
+    //! under the root folder has that name, or the snapshot can't be built 
+    //! because a hierarchy table is missing, every folder in the file is
+    //! searched instead.
     //! \param[in] name The name of the folder to open
     //! \throws key_not_found<std::wstring> If a folder of the specified name was not found in this file
     //! \returns The first folder by that name found in the file
@@ -117,6 +192,13 @@ public:
     //! \returns The message with that id found in the file
     message open_message(node_id id) const
         { return message(m_db->lookup_node(id)); }
+    //! \brief Open a specific message in this file, optionally prefetching
+    //! \param[in] id The node_id of the message to open
+    //! \param[in] prefetch true to read the message's structures in one batch, see \ref message::prefetch()
+    //! \throws key_not_found<node_id> If a message of the specified id was not found in this file
+    //! \returns The message with that id found in the file
+    message open_message(node_id id, bool prefetch) const
+        { return message(m_db->lookup_node(id), prefetch); }
 
     // property access
     //! \brief Get the display name of the PST
@@ -165,9 +247,20 @@ public:
         { return m_db; }
 
 private:
+    //! \brief Get the database handle of the worker running the calling job, opening it if needed
+    static shared_db_ptr worker_db(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor);
+    //! \brief Process a single job of a parallel traversal on its worker's database handle
+    static void run_message_job(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor, const node_info* begin, const node_info* end, const std::tr1::function<void (const message&)>& process);
+    //! \brief Transform a single job of a parallel traversal on its worker's database handle
+    template<typename Result>
+    static void run_transform_job(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor, const node_info* begin, const node_info* end, Result* results, const std::tr1::function<Result (const message&)>& transform);
+
+    std::wstring m_filename;                        //!< The file this store was opened from
     shared_db_ptr m_db;                             //!< The official shared_db_ptr used by this store
     mutable std::tr1::shared_ptr<property_bag> m_bag;    //!< The official property bag of this store object
     mutable std::tr1::shared_ptr<name_id_map> m_map;     //!< The official named property map of this store object
+    mutable std::tr1::shared_ptr<std::vector<std::vector<node_info> > > m_nodes; //!< The node_infos in this store, bucketed by nid_type
+    mutable std::tr1::shared_ptr<folder_tree> m_tree;    //!< The folder hierarchy of this store
 };
 
 } // end pstsdk namespace
@@ -198,12 +291,143 @@ inline pstsdk::name_id_map& pstsdk::pst::get_name_id_map()
     return const_cast<name_id_map&>(const_cast<const pst*>(this)->get_name_id_map());
 }
 
+inline const std::vector<pstsdk::node_info>& pstsdk::pst::get_nodes(nid_type type) const
+{
+    if(static_cast<ulong>(type) >= nid_type_max)
+        throw std::invalid_argument("type");
+
+    if(!m_nodes)
+    {
+        std::tr1::shared_ptr<std::vector<std::vector<node_info> > > nodes(new std::vector<std::vector<node_info> >(nid_type_max));
+        std::tr1::shared_ptr<nbt_page> nbt_root = m_db->read_nbt_root();
+        size_t count = 0;
+
+        // the NBT is in node_id order, so each bucket comes out sorted
+        for(const_nodeinfo_iterator iter = nbt_root->begin(); iter != nbt_root->end(); ++iter, ++count)
+            (*nodes)[get_nid_type(iter->id)].push_back(*iter);
+
+        // having walked the whole NBT, let the database reject missing 
+        // nodes without walking it again
+        std::tr1::shared_ptr<bloom_filter> filter(new bloom_filter(count));
+        for(size_t type = 0; type < nodes->size(); ++type)
+        {
+            for(size_t i = 0; i < (*nodes)[type].size(); ++i)
+                filter->add((*nodes)[type][i].id);
+        }
+        m_db->set_node_filter(filter);
+
+        m_nodes = nodes;
+    }
+
+    return (*m_nodes)[type];
+}
+
+inline void pstsdk::pst::for_each_message(const std::tr1::function<void (const message&)>& process, scan_executor& executor) const
+{
+    const std::vector<node_info>& messages = get_nodes(nid_type_message);
+    std::vector<shared_db_ptr> dbs(executor.worker_count());
+    scan_wait_guard guard(executor);
+    size_t pos = 0;
+
+    while(pos < messages.size())
+    {
+        for(size_t jobs = 0; jobs < pst_jobs_in_flight && pos < messages.size(); ++jobs)
+        {
+            size_t count = std::min(pst_messages_per_job, messages.size() - pos);
+            executor.submit(std::tr1::bind(&pst::run_message_job, std::tr1::cref(m_filename), std::tr1::ref(dbs), std::tr1::cref(executor), &messages[pos], &messages[pos] + count, std::tr1::cref(process)));
+            pos += count;
+        }
+
+        executor.wait();
+    }
+}
+
+template<typename Result>
+inline void pstsdk::pst::transform_messages(const std::tr1::function<Result (const message&)>& transform, const std::tr1::function<void (node_id, const Result&)>& consume, scan_executor& executor) const
+{
+    const std::vector<node_info>& messages = get_nodes(nid_type_message);
+    std::vector<Result> results;
+    std::vector<shared_db_ptr> dbs(executor.worker_count());
+    scan_wait_guard guard(executor);
+    size_t pos = 0;
+
+    while(pos < messages.size())
+    {
+        size_t window = std::min(pst_messages_per_job * pst_jobs_in_flight, messages.size() - pos);
+        results.assign(window, Result());
+
+        for(size_t offset = 0; offset < window; offset += pst_messages_per_job)
+        {
+            size_t count = std::min(pst_messages_per_job, window - offset);
+            executor.submit(std::tr1::bind(&pst::run_transform_job<Result>, std::tr1::cref(m_filename), std::tr1::ref(dbs), std::tr1::cref(executor), &messages[pos + offset], &messages[pos + offset] + count, &results[offset], std::tr1::cref(transform)));
+        }
+
+        executor.wait();
+
+        for(size_t i = 0; i < window; ++i)
+            consume(messages[pos + i].id, results[i]);
+
+        pos += window;
+    }
+}
+
+inline pstsdk::shared_db_ptr pstsdk::pst::worker_db(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor)
+{
+    // each worker only touches its own slot, so no locking is needed
+    shared_db_ptr& db = dbs[executor.current_worker()];
+
+    if(!db)
+        db = open_database(filename);
+
+    return db;
+}
+
+inline void pstsdk::pst::run_message_job(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor, const node_info* begin, const node_info* end, const std::tr1::function<void (const message&)>& process)
+{
+    // node_infos carry the block ids, so nodes open without an NBT lookup
+    shared_db_ptr db = worker_db(filename, dbs, executor);
+
+    for(const node_info* pinfo = begin; pinfo != end; ++pinfo)
+        process(message(node(db, *pinfo)));
+}
+
+template<typename Result>
+inline void pstsdk::pst::run_transform_job(const std::wstring& filename, std::vector<shared_db_ptr>& dbs, const scan_executor& executor, const node_info* begin, const node_info* end, Result* results, const std::tr1::function<Result (const message&)>& transform)
+{
+    shared_db_ptr db = worker_db(filename, dbs, executor);
+
+    for(const node_info* pinfo = begin; pinfo != end; ++pinfo, ++results)
+        *results = transform(message(node(db, *pinfo)));
+}
+
+inline const pstsdk::folder_tree& pstsdk::pst::get_folder_tree() const
+{
+    if(!m_tree)
+        m_tree.reset(new folder_tree(m_db));
+
+    return *m_tree;
+}
+
 inline pstsdk::folder pstsdk::pst::open_folder(const std::wstring& name) const
 {
-    folder_iterator iter = std::find_if(folder_begin(), folder_end(), compiler_workarounds::folder_name_equal(name));
+    try
+    {
+        // lookup_name returns node_id order, which is the order the NBT is in
+        return get_folder_tree().open_folder(get_folder_tree().lookup_name(name)[0]);
+    }
+    catch(key_not_found<std::wstring>&)
+    {
+    }
+    catch(key_not_found<node_id>&)
+    {
+    }
 
-    if(iter != folder_end())
-        return *iter;
+    // the folder may not be reachable from the root folder
+    for(folder_iterator iter = folder_begin(); iter != folder_end(); ++iter)
+    {
+        if((*iter).get_name() == name)
+            return *iter;
+    }
 
     throw key_not_found<std::wstring>(name);
 }
@@ -62,6 +62,13 @@ public:
     //! \param[in] key The key to lookup
     //! \returns The associated value
     virtual const V& lookup(const K& key) const = 0;
+
+    //! \brief Looks up the associated value for a given key, without throwing
+    //!
+    //! This will defer to child btree_nodes as appropriate
+    //! \param[in] key The key to lookup
+    //! \returns The associated value, or 0 if the key is not in this btree
+    virtual const V* find(const K& key) const = 0;
     
     //! \brief Returns the key at the specified position
     //!
@@ -138,6 +145,8 @@ public:
     //! \param[in] key The key to lookup
     //! \returns The associated value
     const V& lookup(const K& key) const;
+    //! \copydoc btree_node::find
+    const V* find(const K& key) const;
 
     //! \brief Returns the value at the associated position on this leaf node
     //! \param[in] pos The position to retrieve the value for
@@ -175,6 +184,8 @@ public:
 
     //! \copydoc btree_node::lookup
     const V& lookup(const K& key) const;
+    //! \copydoc btree_node::find
+    const V* find(const K& key) const;
 
 protected:
     //! \brief Returns the child btree_node at the requested location
@@ -301,6 +312,17 @@ const V& pstsdk::btree_node_leaf<K,V>::lookup(const K& k) const
 
     return get_value(location);
 }
+
+template<typename K, typename V>
+const V* pstsdk::btree_node_leaf<K,V>::find(const K& k) const
+{
+    int location = this->binary_search(k);
+
+    if(location == -1 || this->get_key(location) != k)
+        return 0;
+
+    return &get_value(location);
+}
     
 template<typename K, typename V>
 void pstsdk::btree_node_leaf<K,V>::next(btree_iter_impl<K,V>& iter) const
@@ -365,6 +387,17 @@ const V& pstsdk::btree_node_nonleaf<K,V>::lookup(const K& k) const
     return get_child(location)->lookup(k);
 }
 
+template<typename K, typename V>
+const V* pstsdk::btree_node_nonleaf<K,V>::find(const K& k) const
+{
+    int location = this->binary_search(k);
+
+    if(location == -1)
+        return 0;
+
+    return get_child(location)->find(k);
+}
+
 template<typename K, typename V>
 void pstsdk::btree_node_nonleaf<K,V>::first(btree_iter_impl<K,V>& iter) const
 {
@@ -11,9 +11,12 @@
 #define PSTSDK_UTIL_UTIL_H
 
 #include <cstdio>
+#include <cstring>
 #include <time.h>
 #include <memory>
 #include <vector>
+#include <string>
+#include <cwchar>
 #include <boost/utility.hpp>
 
 #include "pstsdk/util/errors.h"
@@ -61,6 +64,41 @@ private:
     FILE * m_pfile;             //!< The file pointer
 };
 
+//! \brief A Bloom filter over integer keys
+//!
+//! Answers "definitely not present" or "possibly present" for a key, using
+//! a fixed amount of memory per key. Sized at construction for the number 
+//! of keys expected; adding more than that raises the false positive rate
+//! but is otherwise harmless.
+//!
+//! With the defaults here the false positive rate is about 1%.
+//! \ingroup util
+class bloom_filter
+{
+public:
+    //! \brief Construct an empty filter
+    //! \param[in] expected The number of keys which will be added
+    explicit bloom_filter(size_t expected);
+
+    //! \brief Add a key to the filter
+    //! \param[in] key The key to add
+    void add(ulonglong key);
+    //! \brief Check if a key may have been added
+    //! \param[in] key The key to check
+    //! \returns false if the key was definitely not added, true if it may have been
+    bool may_contain(ulonglong key) const;
+
+private:
+    static const size_t bits_per_key = 10;  //!< Filter size, in bits per expected key
+    static const size_t hash_count = 7;     //!< Number of bits set per key
+
+    //! \brief Scramble a key so all of its bits affect the bit positions
+    static ulonglong mix(ulonglong key);
+
+    std::vector<ulonglong> m_bits;  //!< The filter
+    ulonglong m_mask;               //!< The number of bits in the filter, minus one
+};
+
 
 //! \brief Convert from a filetime to time_t
 //!
@@ -109,6 +147,13 @@ double time_t_to_vt_date(time_t time);
 //! \ingroup util
 bool test_bit(const byte* pbytes, ulong bit);
 
+//! \brief Count the number of set bits in a buffer
+//! \param[in] pbytes The buffer to count
+//! \param[in] count The number of bytes in the buffer
+//! \returns The number of bits set
+//! \ingroup util
+size_t count_bits(const byte* pbytes, size_t count);
+
 //! \brief Convert an array of bytes to a std::wstring
 //! \param[in] bytes The bytes to convert
 //! \returns A std::wstring
@@ -121,6 +166,73 @@ std::wstring bytes_to_wstring(const std::vector<byte> &bytes);
 //! \ingroup util
 std::vector<byte> wstring_to_bytes(const std::wstring &wstr);
 
+//! \brief Convert UTF-16LE bytes to UTF-8
+//! \throws std::runtime_error If the bytes are not valid UTF-16LE, including unpaired surrogates
+//! \param[in] pbytes The bytes to convert
+//! \param[in] size The number of bytes to convert
+//! \param[out] out Receives the UTF-8 string, replacing its contents. Its
+//!             storage is reused if it is already large enough.
+//! \ingroup util
+void utf16le_to_utf8(const byte* pbytes, size_t size, std::string& out);
+
+//! \brief Convert 8 bit string bytes to UTF-8
+//!
+//! Each byte is taken as the code point of the same value, the same way 
+//! 8 bit string properties are widened into a std::wstring.
+//! \param[in] pbytes The bytes to convert
+//! \param[in] size The number of bytes to convert
+//! \param[out] out Receives the UTF-8 string, replacing its contents. Its
+//!             storage is reused if it is already large enough.
+//! \ingroup util
+void latin1_to_utf8(const byte* pbytes, size_t size, std::string& out);
+
+//! \cond
+// Helpers for the UTF-16LE converters, which test four code units at a time
+
+//! \brief Load four UTF-16LE code units, one per 16 bit lane
+inline ulonglong load_utf16le_block(const byte* pbytes)
+{
+    return static_cast<ulonglong>(pbytes[0] | (pbytes[1] << 8))
+        | (static_cast<ulonglong>(pbytes[2] | (pbytes[3] << 8)) << 16)
+        | (static_cast<ulonglong>(pbytes[4] | (pbytes[5] << 8)) << 32)
+        | (static_cast<ulonglong>(pbytes[6] | (pbytes[7] << 8)) << 48);
+}
+
+//! \brief Check if no code unit in a block is (half of) a surrogate pair
+inline bool utf16_block_has_no_surrogates(ulonglong block)
+{
+    // a lane is zero exactly where the unit is in 0xd800-0xdfff
+    ulonglong x = (block & 0xf800f800f800f800ull) ^ 0xd800d800d800d800ull;
+    return ((x - 0x0001000100010001ull) & ~x & 0x8000800080008000ull) == 0;
+}
+
+//! \brief Check if every code unit in a block is ASCII
+inline bool utf16_block_is_ascii(ulonglong block)
+{
+    return (block & 0xff80ff80ff80ff80ull) == 0;
+}
+
+//! \brief Decode the code point starting at pbytes, advancing past it
+inline ulong read_utf16le_code_point(const byte*& pbytes, const byte* pend)
+{
+    ulong unit = pbytes[0] | (pbytes[1] << 8);
+    pbytes += 2;
+
+    if(unit < 0xd800 || unit > 0xdfff)
+        return unit;
+
+    if(unit > 0xdbff || pend - pbytes < 2)
+        throw std::runtime_error("Unpaired surrogate in UTF-16LE");
+
+    ulong low = pbytes[0] | (pbytes[1] << 8);
+    if(low < 0xdc00 || low > 0xdfff)
+        throw std::runtime_error("Unpaired surrogate in UTF-16LE");
+    pbytes += 2;
+
+    return 0x10000 + ((unit - 0xd800) << 10) + (low - 0xdc00);
+}
+//! \endcond
+
 } // end pstsdk namespace
 
 inline pstsdk::file::file(const std::wstring& filename)
@@ -185,6 +297,51 @@ inline size_t pstsdk::file::write(const std::vector<byte>& buffer, ulonglong off
 }
 //! \endcond
 
+inline pstsdk::bloom_filter::bloom_filter(size_t expected)
+{
+    // a power of two number of bits, so positions are a mask away
+    ulonglong bits = 64;
+    while(bits < static_cast<ulonglong>(expected) * bits_per_key)
+        bits *= 2;
+
+    m_bits.assign(static_cast<size_t>(bits / 64), 0);
+    m_mask = bits - 1;
+}
+
+inline pstsdk::ulonglong pstsdk::bloom_filter::mix(ulonglong key)
+{
+    // splitmix64 finalizer
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+inline void pstsdk::bloom_filter::add(ulonglong key)
+{
+    ulonglong hash = mix(key);
+    ulonglong step = (hash >> 32) | 1;
+
+    for(size_t i = 0; i < hash_count; ++i, hash += step)
+        m_bits[static_cast<size_t>((hash & m_mask) >> 6)] |= 1ULL << (hash & 63);
+}
+
+inline bool pstsdk::bloom_filter::may_contain(ulonglong key) const
+{
+    ulonglong hash = mix(key);
+    ulonglong step = (hash >> 32) | 1;
+
+    for(size_t i = 0; i < hash_count; ++i, hash += step)
+    {
+        if((m_bits[static_cast<size_t>((hash & m_mask) >> 6)] & (1ULL << (hash & 63))) == 0)
+            return false;
+    }
+
+    return true;
+}
+
 inline time_t pstsdk::filetime_to_time_t(ulonglong filetime)
 {
     const ulonglong jan1970 = 116444736000000000ULL;
@@ -214,6 +371,33 @@ inline bool pstsdk::test_bit(const byte* pbytes, ulong bit)
     return (*(pbytes + (bit >> 3)) & (0x80 >> (bit & 7))) != 0;
 }
 
+inline size_t pstsdk::count_bits(const byte* pbytes, size_t count)
+{
+    size_t bits = 0;
+    size_t i = 0;
+
+    // eight bytes at a time, with a parallel (SWAR) popcount
+    for(; i + sizeof(ulonglong) <= count; i += sizeof(ulonglong))
+    {
+        ulonglong v;
+        memcpy(&v, pbytes + i, sizeof(v));
+
+        v = v - ((v >> 1) & 0x5555555555555555ull);
+        v = (v & 0x3333333333333333ull) + ((v >> 2) & 0x3333333333333333ull);
+        v = (v + (v >> 4)) & 0x0f0f0f0f0f0f0f0full;
+        bits += static_cast<size_t>((v * 0x0101010101010101ull) >> 56);
+    }
+
+    for(; i < count; ++i)
+    {
+        byte b = pbytes[i];
+        for(; b; b &= b - 1)
+            ++bits;
+    }
+
+    return bits;
+}
+
 #if defined(_WIN32) || defined(__MINGW32__)
 
 // We know that std::wstring is always UCS-2LE on Windows.
@@ -235,7 +419,96 @@ inline std::vector<pstsdk::byte> pstsdk::wstring_to_bytes(const std::wstring &ws
     return std::vector<byte>(begin, begin + wstr.size()*sizeof(wchar_t));
 }
 
-#else // !(defined(_WIN32) || defined(__MINGW32__))
+#elif (defined(__STDC_ISO_10646__) || defined(__APPLE__)) && defined(WCHAR_MAX) && (WCHAR_MAX > 0xffff)
+
+// wchar_t holds UTF-32 code points, so we can convert directly. A platform
+// with a 16 bit wchar_t falls through to iconv below.
+
+//! \cond static_asserts
+static_assert(sizeof(wchar_t) == 4, "wchar_t must hold UTF-32 code points");
+//! \endcond
+
+inline std::wstring pstsdk::bytes_to_wstring(const std::vector<byte> &bytes)
+{
+    if(bytes.size() == 0)
+        return std::wstring();
+
+    // Up to one wchar_t for every 2 bytes, if there are no surrogate pairs.
+    if(bytes.size() % 2 != 0)
+        throw std::runtime_error("Cannot interpret odd number of bytes as UTF-16LE");
+    std::wstring out(bytes.size() / 2, L'\0');
+
+    const byte* pbytes = &bytes[0];
+    const byte* pend = pbytes + bytes.size();
+    wchar_t* pout = &out[0];
+
+    while(pbytes != pend)
+    {
+        if(pend - pbytes >= 8)
+        {
+            ulonglong block = load_utf16le_block(pbytes);
+            if(utf16_block_has_no_surrogates(block))
+            {
+                pout[0] = static_cast<wchar_t>(block & 0xffff);
+                pout[1] = static_cast<wchar_t>((block >> 16) & 0xffff);
+                pout[2] = static_cast<wchar_t>((block >> 32) & 0xffff);
+                pout[3] = static_cast<wchar_t>(block >> 48);
+                pout += 4;
+                pbytes += 8;
+                continue;
+            }
+        }
+
+        *pout++ = static_cast<wchar_t>(read_utf16le_code_point(pbytes, pend));
+    }
+
+    out.resize(pout - &out[0]);
+    return out;
+}
+
+inline std::vector<pstsdk::byte> pstsdk::wstring_to_bytes(const std::wstring &wstr)
+{
+    if(wstr.size() == 0)
+        return std::vector<byte>();
+
+    // Up to 4 bytes per character if all codepoints are surrogate pairs.
+    std::vector<byte> out(wstr.size() * 4);
+    byte* pout = &out[0];
+
+    for(std::wstring::const_iterator iter = wstr.begin(); iter != wstr.end(); ++iter)
+    {
+        ulong ch = static_cast<ulong>(*iter);
+
+        if(ch < 0x10000)
+        {
+            if(ch >= 0xd800 && ch <= 0xdfff)
+                throw std::runtime_error("Failed to convert from wstring to UTF-16LE");
+
+            *pout++ = static_cast<byte>(ch);
+            *pout++ = static_cast<byte>(ch >> 8);
+        }
+        else if(ch <= 0x10ffff)
+        {
+            ch -= 0x10000;
+            ulong high = 0xd800 + (ch >> 10);
+            ulong low = 0xdc00 + (ch & 0x3ff);
+
+            *pout++ = static_cast<byte>(high);
+            *pout++ = static_cast<byte>(high >> 8);
+            *pout++ = static_cast<byte>(low);
+            *pout++ = static_cast<byte>(low >> 8);
+        }
+        else
+        {
+            throw std::runtime_error("Failed to convert from wstring to UTF-16LE");
+        }
+    }
+
+    out.resize(pout - &out[0]);
+    return out;
+}
+
+#else // !(defined(_WIN32) || defined(__MINGW32__) || ((defined(__STDC_ISO_10646__) || defined(__APPLE__)) && WCHAR_MAX > 0xffff))
 
 // We're going to have to do this the hard way, since we don't know how
 // big wchar_t really is, or what encoding it uses.
@@ -297,6 +570,93 @@ inline std::vector<pstsdk::byte> pstsdk::wstring_to_bytes(const std::wstring &ws
     return out;
 }
 
-#endif // !(defined(_WIN32) || defined(__MINGW32__))
+#endif // !(defined(_WIN32) || defined(__MINGW32__) || ((defined(__STDC_ISO_10646__) || defined(__APPLE__)) && WCHAR_MAX > 0xffff))
+
+inline void pstsdk::utf16le_to_utf8(const byte* pbytes, size_t size, std::string& out)
+{
+    if(size % 2 != 0)
+        throw std::runtime_error("Cannot interpret odd number of bytes as UTF-16LE");
+
+    // Up to 3 bytes for every 2; a surrogate pair is 4 bytes for 4.
+    out.resize(size / 2 * 3);
+    if(size == 0)
+        return;
+
+    const byte* pend = pbytes + size;
+    char* pstart = &out[0];
+    char* pout = pstart;
+
+    while(pbytes != pend)
+    {
+        if(pend - pbytes >= 8)
+        {
+            ulonglong block = load_utf16le_block(pbytes);
+            if(utf16_block_is_ascii(block))
+            {
+                pout[0] = static_cast<char>(pbytes[0]);
+                pout[1] = static_cast<char>(pbytes[2]);
+                pout[2] = static_cast<char>(pbytes[4]);
+                pout[3] = static_cast<char>(pbytes[6]);
+                pout += 4;
+                pbytes += 8;
+                continue;
+            }
+        }
+
+        ulong ch = read_utf16le_code_point(pbytes, pend);
+
+        if(ch < 0x80)
+        {
+            *pout++ = static_cast<char>(ch);
+        }
+        else if(ch < 0x800)
+        {
+            *pout++ = static_cast<char>(0xc0 | (ch >> 6));
+            *pout++ = static_cast<char>(0x80 | (ch & 0x3f));
+        }
+        else if(ch < 0x10000)
+        {
+            *pout++ = static_cast<char>(0xe0 | (ch >> 12));
+            *pout++ = static_cast<char>(0x80 | ((ch >> 6) & 0x3f));
+            *pout++ = static_cast<char>(0x80 | (ch & 0x3f));
+        }
+        else
+        {
+            *pout++ = static_cast<char>(0xf0 | (ch >> 18));
+            *pout++ = static_cast<char>(0x80 | ((ch >> 12) & 0x3f));
+            *pout++ = static_cast<char>(0x80 | ((ch >> 6) & 0x3f));
+            *pout++ = static_cast<char>(0x80 | (ch & 0x3f));
+        }
+    }
+
+    out.resize(pout - pstart);
+}
+
+inline void pstsdk::latin1_to_utf8(const byte* pbytes, size_t size, std::string& out)
+{
+    // Up to 2 bytes for every 1.
+    out.resize(size * 2);
+    if(size == 0)
+        return;
+
+    const byte* pend = pbytes + size;
+    char* pstart = &out[0];
+    char* pout = pstart;
+
+    for(; pbytes != pend; ++pbytes)
+    {
+        if(*pbytes < 0x80)
+        {
+            *pout++ = static_cast<char>(*pbytes);
+        }
+        else
+        {
+            *pout++ = static_cast<char>(0xc0 | (*pbytes >> 6));
+            *pout++ = static_cast<char>(0x80 | (*pbytes & 0x3f));
+        }
+    }
+
+    out.resize(pout - pstart);
+}
 
 #endif
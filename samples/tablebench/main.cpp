@@ -0,0 +1,67 @@
+#include <iostream>     // cout
+#include <vector>
+#include <ctime>        // clock
+#include <cstdlib>      // atoi
+
+#include "pstsdk/ndb.h"
+#include "pstsdk/ltp.h"
+
+using namespace pstsdk;
+using namespace std;
+
+// Measures the per cell overhead of table access, by reading every cell of 
+// every table in a pst file one at a time, repeatedly.
+int main(int argc, char** argv)
+{
+    if(argc < 2)
+    {
+        cout << "usage: tablebench <file.pst> [iterations]" << endl;
+        return 1;
+    }
+
+    string path(argv[1]);
+    wstring wpath(path.begin(), path.end());
+    int iterations = (argc > 2 ? atoi(argv[2]) : 100);
+
+    shared_db_ptr db(open_database(wpath));
+    std::tr1::shared_ptr<const nbt_page> nbt_root = db->read_nbt_root();
+    vector<table> tables;
+
+    for(const_nodeinfo_iterator iter = nbt_root->begin(); iter != nbt_root->end(); ++iter)
+    {
+        nid_type type = get_nid_type(iter->id);
+
+        if(type == nid_type_hierarchy_table || type == nid_type_contents_table || type == nid_type_associated_contents_table)
+            tables.push_back(table(node(db, *iter)));
+    }
+
+    ulonglong cells = 0;
+    ulonglong checksum = 0;
+    clock_t start = clock();
+
+    for(int i = 0; i < iterations; ++i)
+    {
+        for(size_t t = 0; t < tables.size(); ++t)
+        {
+            vector<prop_id> columns = tables[t].get_prop_list();
+
+            for(pstsdk::ulong row = 0; row < tables[t].size(); ++row)
+            {
+                for(size_t c = 0; c < columns.size(); ++c)
+                {
+                    ++cells;
+                    if(tables[t][row].prop_exists(columns[c]))
+                        checksum += tables[t].get_cell_value(row, columns[c]);
+                }
+            }
+        }
+    }
+
+    double seconds = double(clock() - start) / CLOCKS_PER_SEC;
+
+    cout << tables.size() << " tables, " << cells << " cells in " << seconds << "s" << endl;
+    if(cells)
+        cout << (seconds * 1e9 / cells) << " ns per cell (checksum " << checksum << ")" << endl;
+
+    return 0;
+}
@@ -91,7 +91,10 @@ void test_btree()
     for(int i = 0; i < 9; ++i)
     {
         assert(strcmp(nl.lookup(i).c_str(), results[i]) == 0);
+        assert(nl.find(i) == &nl.lookup(i));
     }
+    assert(nl.find(10) == 0);
+    assert(nl.find(-1) == 0);
 
     bool knf_caught = false;
     try
@@ -1,5 +1,7 @@
 #include <iostream>
 #include <cassert>
+#include <vector>
+#include <algorithm>
 #include "pstsdk/disk/disk.h"
 #include "pstsdk/ndb.h"
 
@@ -80,7 +82,79 @@ void process_node(const pstsdk::node& n)
     {
         process_node(node(n, *iter));
     }
-    
+
+    // probes agree with the subnode tree, both before and after the node
+    // has seen enough of them to build its index
+    for(int pass = 0; pass < 2; ++pass)
+    {
+        for(const_subnodeinfo_iterator iter = n.subnode_info_begin();
+                        iter != n.subnode_info_end();
+                        ++iter)
+        {
+            assert(n.subnode_exists(iter->id));
+        }
+        assert(!n.subnode_exists(0xffffffe0));
+    }
+
+    // the subnode index must agree with the subnode tree
+    const subnode_index& index = n.build_subnode_index();
+    size_t count = 0;
+    for(const_subnodeinfo_iterator iter = n.subnode_info_begin();
+                    iter != n.subnode_info_end();
+                    ++iter, ++count)
+    {
+        assert(index.lookup(iter->id).data_bid == iter->data_bid);
+        assert(index.lookup(iter->id).sub_bid == iter->sub_bid);
+        assert(n.lookup(iter->id).get_id() == iter->id);
+    }
+    assert(index.size() == count);
+
+    bool not_found = false;
+    try
+    {
+        n.lookup(0xffffffe0);
+    }
+    catch(key_not_found<node_id>&)
+    {
+        not_found = true;
+    }
+    assert(not_found);
+}
+
+struct byte_appender
+{
+    byte_appender(std::vector<pstsdk::byte>* pbytes) : m_pbytes(pbytes) { }
+    void operator()(const pstsdk::byte* pdata, size_t size) const
+        { m_pbytes->insert(m_pbytes->end(), pdata, pdata + size); }
+    std::vector<pstsdk::byte>* m_pbytes;
+};
+
+// compares read_all and stream_to against a plain read for a node and all of
+// its subnodes. returns the number of multi-page nodes seen.
+int test_node_read_all(const pstsdk::node& n)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    int multi_page = n.get_page_count() > 1 ? 1 : 0;
+
+    // stream before anything is cached on the node
+    vector<byte> streamed;
+    assert(n.stream_to(byte_appender(&streamed)) == n.size());
+
+    vector<byte> contents(n.size());
+    (void)n.read(contents, 0);
+    assert(n.read_all() == contents);
+    assert(streamed == contents);
+
+    for(const_subnodeinfo_iterator iter = n.subnode_info_begin();
+                    iter != n.subnode_info_end();
+                    ++iter)
+    {
+        multi_page += test_node_read_all(node(n, *iter));
+    }
+
+    return multi_page;
 }
 
 size_t step_size_up(size_t i)
@@ -125,6 +199,50 @@ void test_node_impl(pstsdk::node& n, size_t expected)
     }
 }
 
+// streams a multi-page node in chunks which straddle page boundaries, and
+// seeks around, to exercise the stream device's page cursor
+void test_node_stream_pages(pstsdk::node& n)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    assert(n.get_page_count() > 2);
+
+    // stamp every page so a read from the wrong page is noticed
+    for(pstsdk::uint page = 0; page < n.get_page_count(); ++page)
+        n.write<pstsdk::uint>(page + 1, page, 0);
+
+    vector<byte> contents(n.size());
+    (void)n.read(contents, 0);
+
+    node_stream stream(n.open_as_stream());
+    vector<char> chunk(1000);
+    size_t pos = 0;
+
+    while(stream.read(&chunk[0], chunk.size()) || stream.gcount() > 0)
+    {
+        for(streamsize i = 0; i < stream.gcount(); ++i, ++pos)
+            assert((byte)chunk[i] == contents[pos]);
+    }
+    assert(pos == contents.size());
+
+    // jump back onto the second page, then read across into the third
+    size_t page_size = n.get_page_size(0);
+    stream.clear();
+    stream.seekg(page_size + page_size / 2, ios_base::beg);
+    vector<byte> span(page_size);
+    stream.read(reinterpret_cast<char*>(&span[0]), span.size());
+    assert(stream.gcount() == (streamsize)span.size());
+    assert(equal(span.begin(), span.end(), contents.begin() + page_size + page_size / 2));
+
+    // and backwards again, onto the first page
+    stream.seekg(-(streamsize)(2 * page_size), ios_base::cur);
+    pstsdk::uint stamp = 0;
+    stream.read(reinterpret_cast<char*>(&stamp), sizeof(stamp));
+    assert((size_t)stream.tellg() == page_size / 2 + sizeof(stamp));
+    assert(equal(reinterpret_cast<byte*>(&stamp), reinterpret_cast<byte*>(&stamp) + sizeof(stamp), contents.begin() + page_size / 2));
+}
+
 template<typename T>
 void test_node_resize(pstsdk::node n)
 {
@@ -133,6 +251,12 @@ void test_node_resize(pstsdk::node n)
     {
         n.resize(i);
         test_node_impl<T>(n, i);
+
+        if(i == 100000)
+        {
+            test_node_stream_pages(n);
+            (void)test_node_read_all(n);
+        }
     }
 
     // ramp down
@@ -190,6 +314,79 @@ void test_node_stream(pstsdk::node n)
     
 }
 
+// exposes the read planner, with the end of the file moved out far enough
+// that blocks can be placed at any made up address
+class read_planner_db : public pstsdk::large_pst
+{
+public:
+    explicit read_planner_db(const std::wstring& filename)
+        : pstsdk::large_pst(filename) { m_header.root_info.ibFileEof = 64 * 1024 * 1024; }
+
+    using pstsdk::large_pst::planned_read;
+    using pstsdk::large_pst::plan_block_reads;
+};
+
+// a block taking up 128 bytes on disk
+pstsdk::block_info planner_block(pstsdk::block_id id, pstsdk::ulonglong address)
+{
+    pstsdk::block_info bi = { id, address, 100, 1 };
+    assert(pstsdk::disk::align_disk<pstsdk::ulonglong>(bi.size) == 128);
+    return bi;
+}
+
+void test_read_planner()
+{
+    using namespace std;
+    using namespace std::tr1;
+    using namespace pstsdk;
+
+    shared_ptr<read_planner_db> db(new read_planner_db(L"test_unicode.pst"));
+    const ulonglong base = 0x10000;
+
+    // adjacent blocks and blocks within the gap share a read, in address
+    // order whatever order they were asked for in; a block past the gap
+    // starts a new read, and an id of zero is skipped
+    vector<pstsdk::block_info> infos;
+    infos.push_back(planner_block(4, base + 256 + 1000 + 128 + 4096 + 1));
+    infos.push_back(planner_block(3, base + 256 + 1000));
+    infos.push_back(planner_block(1, base));
+    infos.push_back(planner_block(0, base + 128));
+    infos.push_back(planner_block(2, base + 128));
+    db->set_read_coalesce_gap(4096);
+    vector<read_planner_db::planned_read> plan = db->plan_block_reads(infos);
+    assert(plan.size() == 2);
+    assert(plan[0].address == base);
+    assert(plan[0].size == 256 + 1000 + 128);
+    assert(plan[0].blocks.size() == 3);
+    assert(plan[0].blocks[0] == 2 && plan[0].blocks[1] == 4 && plan[0].blocks[2] == 1);
+    assert(plan[1].address == infos[0].address);
+    assert(plan[1].size == 128);
+    assert(plan[1].blocks.size() == 1 && plan[1].blocks[0] == 0);
+
+    // a gap of zero only joins blocks which touch
+    infos.clear();
+    infos.push_back(planner_block(1, base));
+    infos.push_back(planner_block(2, base + 128));
+    infos.push_back(planner_block(3, base + 256 + 64));
+    db->set_read_coalesce_gap(0);
+    plan = db->plan_block_reads(infos);
+    assert(plan.size() == 2);
+    assert(plan[0].size == 256 && plan[0].blocks.size() == 2);
+    assert(plan[1].address == base + 256 + 64 && plan[1].blocks.size() == 1);
+
+    // however large the gap, no read grows past max_coalesced_read_size
+    infos.clear();
+    infos.push_back(planner_block(1, base));
+    infos.push_back(planner_block(2, base + max_coalesced_read_size / 2));
+    infos.push_back(planner_block(3, base + max_coalesced_read_size));
+    db->set_read_coalesce_gap(4 * max_coalesced_read_size);
+    plan = db->plan_block_reads(infos);
+    assert(plan.size() == 2);
+    assert(plan[0].address == base && plan[0].blocks.size() == 2);
+    assert(plan[0].size == max_coalesced_read_size / 2 + 128);
+    assert(plan[1].address == base + max_coalesced_read_size && plan[1].blocks.size() == 1);
+}
+
 void test_db()
 {
     using namespace std;
@@ -276,6 +473,56 @@ void test_db()
         assert(iter->size == block_info_ansi[block].size);
         assert(iter->ref_count == block_info_ansi[block].refs);
     }
+
+    // sample1.pst contains a node stored in an xblock. read it with the read
+    // planner joining only adjacent blocks, then reading through large holes
+    shared_db_ptr db_4 = open_database(L"sample1.pst");
+    assert(db_4->get_read_coalesce_gap() == default_read_coalesce_gap);
+    size_t gaps[] = { 0, 64 * 1024 };
+    for(int gap = 0; gap < 2; ++gap)
+    {
+        db_4->set_read_coalesce_gap(gaps[gap]);
+
+        int multi_page = 0;
+        for(const_nodeinfo_iterator iter = db_4->read_nbt_root()->begin();
+                        iter != db_4->read_nbt_root()->end();
+                        ++iter)
+        {
+            multi_page += test_node_read_all(pstsdk::node(db_4, *iter));
+        }
+        assert(multi_page > 0);
+    }
+
+    // and the plan itself joins and splits reads as it should
+    test_read_planner();
+
+    // with a node filter installed, every node is still found and missing
+    // nodes are still missing
+    for(int filtered = 0; filtered < 2; ++filtered)
+    {
+        if(filtered)
+            db_3->build_node_filter();
+
+        for(node = 0; node < sizeof(node_info_ansi) / sizeof(node_info_ansi[0]); ++node)
+        {
+            assert(db_3->node_exists(node_info_ansi[node].node));
+            assert(db_3->lookup_node_info(node_info_ansi[node].node).id == node_info_ansi[node].node);
+        }
+
+        node_id missing = make_nid(nid_type_message, 0xfffff);
+        assert(!db_3->node_exists(missing));
+        bool not_found = false;
+        try
+        {
+            db_3->lookup_node(missing);
+        }
+        catch(key_not_found<node_id>&)
+        {
+            not_found = true;
+        }
+        assert(not_found);
+    }
 }
 
 
+
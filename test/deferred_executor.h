@@ -0,0 +1,32 @@
+#ifndef DEFERRED_EXECUTOR_H
+#define DEFERRED_EXECUTOR_H
+
+#include <vector>
+#include "pstsdk/ltp/table.h"
+
+// runs the queued jobs last first when waited on, to shake out ordering
+// assumptions; job i (in submission order) runs as worker i % workers
+class deferred_executor : public pstsdk::scan_executor
+{
+public:
+    explicit deferred_executor(size_t workers = 1) : m_workers(workers), m_current(0) { }
+    void submit(const std::tr1::function<void ()>& job) { m_jobs.push_back(job); }
+    void wait()
+    {
+        while(!m_jobs.empty())
+        {
+            m_current = (m_jobs.size() - 1) % m_workers;
+            m_jobs.back()();
+            m_jobs.pop_back();
+        }
+    }
+    size_t worker_count() const { return m_workers; }
+    size_t current_worker() const { return m_current; }
+
+private:
+    std::vector<std::tr1::function<void ()> > m_jobs;
+    size_t m_workers;
+    size_t m_current;
+};
+
+#endif
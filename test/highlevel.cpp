@@ -1,7 +1,9 @@
 #include <cassert>
 #include <iostream>
 #include <string>
+#include <map>
 #include "test.h"
+#include "deferred_executor.h"
 #include "pstsdk/ndb.h"
 #include "pstsdk/ltp.h"
 
@@ -51,6 +53,16 @@ void test_nameid_map_samp1(pstsdk::shared_db_ptr pdb)
         not_found = true;
     }
     assert(not_found);
+
+    // every mapped prop_id round trips through the in memory index
+    std::vector<prop_id> ids = nm.get_prop_list();
+    assert(ids.size() == nm.get_prop_count());
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        assert(nm.prop_id_exists(ids[i]));
+        assert(nm.lookup(nm.lookup(ids[i])) == ids[i]);
+    }
+    assert(!nm.prop_id_exists(static_cast<prop_id>(0x8000 + nm.get_prop_count())));
 }
 
 void test_prop_stream(pstsdk::const_property_object& obj, pstsdk::prop_id id)
@@ -67,6 +79,283 @@ void test_prop_stream(pstsdk::const_property_object& obj, pstsdk::prop_id id)
         assert(b == contents[pos++]);
 }
 
+// collects the row ids and cells seen by a parallel scan
+struct scan_collector
+{
+    scan_collector(size_t rows, size_t columns)
+        : row_ids(rows), values(rows, std::vector<pstsdk::ulonglong>(columns)), seen(rows, 0) { }
+
+    void operator()(const pstsdk::column_batch& batch)
+    {
+        for(size_t row = 0; row < batch.rows(); ++row)
+        {
+            size_t pos = batch.get_start_row() + row;
+            ++seen[pos];
+            row_ids[pos] = batch.get_row_ids()[row];
+            for(size_t col = 0; col < batch.columns(); ++col)
+                values[pos][col] = batch.get_value(row, col);
+        }
+    }
+
+    std::vector<pstsdk::row_id> row_ids;
+    std::vector<std::vector<pstsdk::ulonglong> > values;
+    std::vector<int> seen;
+};
+
+struct count_job
+{
+    count_job(size_t* pcount) : m_pcount(pcount) { }
+    void operator()() const { ++*m_pcount; }
+    size_t* m_pcount;
+};
+
+// a parallel scan sees every row once, with the same cells as read_columns
+void test_parallel_scan(const pstsdk::table& tc, const pstsdk::column_batch& expected)
+{
+    using namespace pstsdk;
+
+    sequential_executor sequential;
+    deferred_executor deferred;
+    scan_executor* executors[] = { &sequential, &deferred };
+
+    for(size_t e = 0; e < 2; ++e)
+    {
+        scan_collector collector(tc.size(), expected.columns());
+        tc.parallel_scan(expected.get_prop_ids(), std::tr1::ref(collector), *executors[e]);
+
+        for(size_t row = 0; row < tc.size(); ++row)
+        {
+            assert(collector.seen[row] == 1);
+            assert(collector.row_ids[row] == expected.get_row_ids()[row]);
+            for(size_t col = 0; col < expected.columns(); ++col)
+                assert(collector.values[row][col] == expected.get_value(row, col));
+        }
+    }
+
+    // jobs submitted before an exception still finish before the stack unwinds
+    size_t ran = 0;
+    try
+    {
+        scan_wait_guard guard(deferred);
+        deferred.submit(count_job(&ran));
+        throw std::runtime_error("scan failed");
+    }
+    catch(std::runtime_error&)
+    {
+    }
+    assert(ran == 1);
+}
+
+// decoding rows by column gives the same cells as reading them one at a time
+void test_column_batch(const pstsdk::table& tc)
+{
+    using namespace pstsdk;
+
+    std::vector<prop_id> ids(tc.get_prop_list());
+    ids.push_back(0x0001); // not a column of any table
+
+    column_batch batch;
+    tc.read_columns(0, tc.size(), ids, batch);
+    assert(batch.rows() == tc.size());
+    assert(batch.columns() == ids.size());
+
+    for(size_t row = 0; row < batch.rows(); ++row)
+    {
+        assert(batch.get_row_ids()[row] == tc.get_row_id(row));
+
+        for(size_t col = 0; col < batch.columns(); ++col)
+        {
+            bool exists = tc[row].prop_exists(ids[col]);
+            assert(batch.is_valid(row, col) == exists);
+            assert(test_bit(&batch.get_validity(col)[0], row) == exists);
+            assert(batch.get_value(row, col) == (exists ? tc.get_cell_value(row, ids[col]) : 0));
+        }
+    }
+
+    test_parallel_scan(tc, batch);
+
+    // existance only, and column statistics
+    column_batch exists;
+    tc.read_exists(0, tc.size(), ids, exists);
+    assert(exists.rows() == tc.size());
+    for(size_t col = 0; col < exists.columns(); ++col)
+    {
+        assert(exists.get_values(col).empty());
+        assert(exists.get_validity(col) == batch.get_validity(col));
+
+        size_t count = 0;
+        for(size_t row = 0; row < batch.rows(); ++row)
+            if(batch.is_valid(row, col))
+                ++count;
+        assert(exists.count_valid(col) == count);
+    }
+    assert(exists.count_valid(ids.size() - 1) == 0);
+
+    // the props on a row are exactly the columns whose cell exists
+    for(size_t row = 0; row < batch.rows(); ++row)
+    {
+        std::vector<prop_id> props(tc[row].get_prop_list());
+        size_t count = 0;
+        for(size_t col = 0; col < batch.columns(); ++col)
+        {
+            if(batch.is_valid(row, col))
+            {
+                assert(std::find(props.begin(), props.end(), ids[col]) != props.end());
+                ++count;
+            }
+        }
+        assert(props.size() == count);
+    }
+
+    // a range starting part way into the table
+    if(tc.size() > 2)
+    {
+        tc.read_columns(1, tc.size() - 2, ids, batch);
+        assert(batch.get_start_row() == 1);
+        assert(batch.rows() == tc.size() - 2);
+        for(size_t row = 0; row < batch.rows(); ++row)
+            assert(batch.get_row_ids()[row] == tc.get_row_id(row + 1));
+    }
+
+    bool out_of_range = false;
+    try
+    {
+        tc.read_columns(0, tc.size() + 1, ids, batch);
+    }
+    catch(std::out_of_range&)
+    {
+        out_of_range = true;
+    }
+    assert(out_of_range);
+}
+
+// predicates evaluated against the row matrix agree with row by row reads
+void test_find_rows(const pstsdk::table& tc)
+{
+    using namespace pstsdk;
+
+    std::vector<prop_id> ids(tc.get_prop_list());
+    std::vector<column_predicate> predicates;
+
+    // a column no table has
+    predicates.push_back(column_predicate(0x0001, column_predicate::predicate_not_exists));
+    assert(tc.find_rows(predicates).size() == tc.size());
+    predicates.back() = column_predicate(0x0001, column_predicate::predicate_exists);
+    assert(tc.find_rows(predicates).empty());
+
+    // float cells compare as floats, negative values included
+    float minus = -1.5f;
+    float plus = 2.0f;
+    pstsdk::ulong minus_bits, plus_bits;
+    memcpy(&minus_bits, &minus, sizeof(minus_bits));
+    memcpy(&plus_bits, &plus, sizeof(plus_bits));
+    assert(column_predicate(0x0001, column_predicate::predicate_less, plus_bits).matches(true, minus_bits, prop_type_float, 4));
+    assert(!column_predicate(0x0001, column_predicate::predicate_greater, plus_bits).matches(true, minus_bits, prop_type_float, 4));
+
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        predicates.assign(1, column_predicate(ids[i], column_predicate::predicate_exists));
+        std::vector<pstsdk::ulong> rows = tc.find_rows(predicates);
+
+        std::vector<pstsdk::ulong> expected;
+        for(pstsdk::ulong row = 0; row < tc.size(); ++row)
+            if(tc[row].prop_exists(ids[i]))
+                expected.push_back(row);
+        assert(rows == expected);
+
+        if(expected.empty())
+            continue;
+
+        // every row with the same cell value as the first, then every row with a smaller one
+        ulonglong value = tc.get_cell_value(expected[0], ids[i]);
+        predicates.push_back(column_predicate(ids[i], column_predicate::predicate_equal, value));
+        rows = tc.find_rows(predicates);
+        assert(!rows.empty() && rows[0] == expected[0]);
+        for(size_t j = 0; j < rows.size(); ++j)
+            assert(tc.get_cell_value(rows[j], ids[i]) == value);
+
+        predicates.back() = column_predicate(ids[i], column_predicate::predicate_not_equal, value);
+        assert(tc.find_rows(predicates).size() + rows.size() == expected.size());
+
+        predicates.back() = column_predicate(ids[i], column_predicate::predicate_all_bits, value);
+        std::vector<pstsdk::ulong> all_bits = tc.find_rows(predicates);
+        assert(std::find(all_bits.begin(), all_bits.end(), expected[0]) != all_bits.end());
+
+        predicates.back() = column_predicate(ids[i], column_predicate::predicate_less_equal, value);
+        std::vector<pstsdk::ulong> less_equal = tc.find_rows(predicates);
+        predicates.back() = column_predicate(ids[i], column_predicate::predicate_greater, value);
+        assert(tc.find_rows(predicates).size() + less_equal.size() == expected.size());
+    }
+}
+
+// sorted views and column indexes over a table
+void test_sorted_views(const pstsdk::table& tc)
+{
+    using namespace pstsdk;
+
+    std::vector<prop_id> ids(tc.get_prop_list());
+
+    for(size_t i = 0; i < ids.size(); ++i)
+    {
+        prop_type type = tc.get_prop_type(ids[i]);
+
+        for(int descending = 0; descending < 2; ++descending)
+        {
+            std::tr1::shared_ptr<const std::vector<pstsdk::ulong> > porder = tc.get_sort_order(ids[i], descending != 0);
+            assert(porder == tc.get_sort_order(ids[i], descending != 0));
+            assert(porder->size() == tc.size());
+
+            std::vector<pstsdk::ulong> sorted(*porder);
+            std::sort(sorted.begin(), sorted.end());
+            for(size_t j = 0; j < sorted.size(); ++j)
+                assert(sorted[j] == j);
+
+            for(size_t j = 1; j < porder->size(); ++j)
+            {
+                const_table_row prev = tc[(*porder)[j-1]];
+                const_table_row cur = tc[(*porder)[j]];
+
+                // rows without the cell come last
+                if(!cur.prop_exists(ids[i]))
+                    continue;
+                assert(prev.prop_exists(ids[i]));
+
+                if(type == prop_type_long)
+                    assert(descending ? prev.read_prop<slong>(ids[i]) >= cur.read_prop<slong>(ids[i]) : prev.read_prop<slong>(ids[i]) <= cur.read_prop<slong>(ids[i]));
+                else if(type == prop_type_systime || type == prop_type_longlong)
+                    assert(descending ? prev.read_prop<slonglong>(ids[i]) >= cur.read_prop<slonglong>(ids[i]) : prev.read_prop<slonglong>(ids[i]) <= cur.read_prop<slonglong>(ids[i]));
+                else if(type == prop_type_wstring || type == prop_type_binary)
+                    assert(descending ? !(prev.read_prop<std::vector<byte> >(ids[i]) < cur.read_prop<std::vector<byte> >(ids[i])) : !(cur.read_prop<std::vector<byte> >(ids[i]) < prev.read_prop<std::vector<byte> >(ids[i])));
+            }
+
+            size_t count = 0;
+            for(const_table_view_iter iter = tc.sorted_begin(ids[i], descending != 0); iter != tc.sorted_end(ids[i], descending != 0); ++iter, ++count)
+            {
+                assert(iter.get_row() == (*porder)[count]);
+                assert(iter->get_row_id() == tc.get_row_id((*porder)[count]));
+            }
+            assert(count == tc.size());
+        }
+
+        // every row can be found by its own value
+        for(pstsdk::ulong row = 0; row < tc.size(); ++row)
+        {
+            if(!tc[row].prop_exists(ids[i]))
+                continue;
+
+            std::vector<pstsdk::ulong> rows;
+            if(type == prop_type_wstring || type == prop_type_string || type == prop_type_binary || type == prop_type_guid || type == prop_type_object)
+                rows = tc.find_rows_by_value(ids[i], tc.read_cell(row, ids[i]));
+            else if(type != prop_type_unspecified && !(type & 0x1000))
+                rows = tc.find_rows_by_value(ids[i], tc.get_cell_value(row, ids[i]));
+            else
+                continue;
+
+            assert(std::find(rows.begin(), rows.end(), row) != rows.end());
+        }
+    }
+}
+
 void test_table(const pstsdk::table& tc)
 {
     using namespace std;
@@ -119,6 +408,10 @@ void test_table(const pstsdk::table& tc)
             }
         }
     }
+
+    test_column_batch(tc);
+    test_find_rows(tc);
+    test_sorted_views(tc);
 }
 
 void test_attachment_table(const pstsdk::node& message, const pstsdk::table& tc)
@@ -159,6 +452,384 @@ void test_attachment_table(const pstsdk::node& message, const pstsdk::table& tc)
     }
 }
 
+// overwrites the start of an allocation in a heap on node
+void write_heap_alloc(pstsdk::node& n, pstsdk::heap_id id, std::vector<pstsdk::byte> data)
+{
+    using namespace pstsdk;
+
+    disk::heap_page_header header = n.read<disk::heap_page_header>(get_heap_page(id), 0);
+    std::vector<byte> map(n.get_page_size(get_heap_page(id)) - header.page_map_offset);
+    n.read(map, get_heap_page(id), header.page_map_offset);
+    const disk::heap_page_map* pmap = reinterpret_cast<const disk::heap_page_map*>(&map[0]);
+
+    n.write(data, get_heap_page(id), pmap->allocs[get_heap_index(id)]);
+}
+
+// serves chosen data blocks from memory, in place of the ones in the file
+template<typename T>
+class block_override_db : public pstsdk::database_impl<T>
+{
+public:
+    explicit block_override_db(const std::wstring& filename)
+        : pstsdk::database_impl<T>(filename) { }
+
+    void override_block(pstsdk::block_id bid, const std::vector<pstsdk::byte>& data)
+        { m_blocks[bid] = data; }
+
+    using pstsdk::database_impl<T>::read_data_block;
+    std::tr1::shared_ptr<pstsdk::data_block> read_data_block(const pstsdk::shared_db_ptr& parent, const pstsdk::block_info& bi)
+    {
+        typename std::map<pstsdk::block_id, std::vector<pstsdk::byte> >::const_iterator iter = m_blocks.find(bi.id);
+
+        if(iter == m_blocks.end())
+            return pstsdk::database_impl<T>::read_data_block(parent, bi);
+
+        pstsdk::block_info info(bi);
+        info.size = static_cast<pstsdk::ushort>(iter->second.size());
+        return std::tr1::shared_ptr<pstsdk::data_block>(new pstsdk::external_block(parent, info, iter->second.size(), iter->second));
+    }
+
+private:
+    std::map<pstsdk::block_id, std::vector<pstsdk::byte> > m_blocks;
+};
+
+// no sample file has a GUST table, so one is made from a copy of a TC
+// posing as the GUST node, with its signatures and header rewritten. Its
+// column descriptions go in a subnode borrowed from another node, whose
+// data is served from memory.
+template<typename T>
+void test_gust_table(const std::wstring& filename)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    std::tr1::shared_ptr<block_override_db<T> > poverride(new block_override_db<T>(filename));
+    shared_db_ptr pdb = poverride;
+
+    node_info info = pdb->lookup_node_info(make_nid(nid_type_hierarchy_table, get_nid_index(nid_root_folder)));
+    table tc(pdb->lookup_node(info.id));
+    heap tc_heap(pdb->lookup_node(info.id));
+    vector<byte> tc_info = tc_heap.read(tc_heap.get_root_id());
+    const disk::tc_header* ptc = reinterpret_cast<const disk::tc_header*>(&tc_info[0]);
+    assert(tc_info.size() >= sizeof(disk::gust_header));
+    assert(ptc->num_columns > 0);
+
+    // find a subnode stored in a single external block to hold the columns
+    node_info host;
+    subnode_info column_info;
+    memset(&host, 0, sizeof(host));
+    memset(&column_info, 0, sizeof(column_info));
+    std::tr1::shared_ptr<const nbt_page> nbt_root = pdb->read_nbt_root();
+    for(const_nodeinfo_iterator iter = nbt_root->begin(); iter != nbt_root->end() && column_info.id == 0; ++iter)
+    {
+        if(iter->sub_bid == 0)
+            continue;
+
+        node candidate(pdb, *iter);
+        for(const_subnodeinfo_iterator sub = candidate.subnode_info_begin(); sub != candidate.subnode_info_end(); ++sub)
+        {
+            if(sub->data_bid != 0 && disk::bid_is_external(sub->data_bid))
+            {
+                host = *iter;
+                column_info = *sub;
+                break;
+            }
+        }
+    }
+    assert(column_info.id != 0);
+
+    vector<disk::gust_column_description> columns(ptc->num_columns);
+    memset(&columns[0], 0, columns.size() * sizeof(columns[0]));
+    for(size_t i = 0; i < columns.size(); ++i)
+    {
+        columns[i].type = ptc->columns[i].type;
+        columns[i].id = ptc->columns[i].id;
+        columns[i].offset = ptc->columns[i].offset;
+        columns[i].size = ptc->columns[i].size;
+        columns[i].bit_offset = ptc->columns[i].bit_offset;
+    }
+    poverride->override_block(column_info.data_bid, vector<byte>(reinterpret_cast<byte*>(&columns[0]), reinterpret_cast<byte*>(&columns[0]) + columns.size() * sizeof(columns[0])));
+
+    disk::gust_header gust;
+    memset(&gust, 0, sizeof(gust));
+    gust.signature = disk::heap_sig_chtc;
+    memcpy(gust.size_offsets, ptc->size_offsets, sizeof(gust.size_offsets));
+    gust.row_btree_id = ptc->row_btree_id;
+    gust.row_matrix_id = ptc->row_matrix_id;
+    gust.num_columns = ptc->num_columns;
+    gust.column_subnode = column_info.id;
+    vector<byte> gust_info(reinterpret_cast<byte*>(&gust), reinterpret_cast<byte*>(&gust) + sizeof(gust));
+
+    info.id = nid_all_message_search_contents;
+    info.sub_bid = host.sub_bid;
+    node n(pdb, info);
+    disk::heap_first_header first = n.read<disk::heap_first_header>(0);
+    first.client_signature = disk::heap_sig_chtc;
+    vector<byte> first_bytes(reinterpret_cast<byte*>(&first), reinterpret_cast<byte*>(&first) + sizeof(first));
+    n.write(first_bytes, 0);
+    write_heap_alloc(n, tc_heap.get_root_id(), gust_info);
+
+    // the rows read through the GUST header exactly as through the TC one
+    table t(n);
+    assert(t.size() == tc.size());
+    assert(t.get_prop_list() == tc.get_prop_list());
+    for(pstsdk::ulong i = 0; i < t.size(); ++i)
+    {
+        assert(t[i].get_row_id() == tc[i].get_row_id());
+        assert(t[i].get_prop_list() == tc[i].get_prop_list());
+        assert(t[i].prop_exists(0x3001) == tc[i].prop_exists(0x3001));
+        if(tc[i].prop_exists(0x3001))
+            assert(t[i].read_prop<wstring>(0x3001) == tc[i].read_prop<wstring>(0x3001));
+        if(tc[i].prop_exists(0x3602))
+            assert(t[i].read_prop<slong>(0x3602) == tc[i].read_prop<slong>(0x3602));
+    }
+
+    // a GUST header must carry the GUST signature
+    gust_info[0] = disk::heap_sig_tc;
+    write_heap_alloc(n, tc_heap.get_root_id(), gust_info);
+    bool mismatch = false;
+    try
+    {
+        table bad(n);
+    }
+    catch(sig_mismatch&)
+    {
+        mismatch = true;
+    }
+    assert(mismatch);
+
+    // a column reaching past the end of the row is rejected, whether it is
+    // described in a GUST column subnode or in a TC header
+    gust_info[0] = disk::heap_sig_chtc;
+    write_heap_alloc(n, tc_heap.get_root_id(), gust_info);
+    columns[0].offset = ptc->size_offsets[disk::tc_offsets_bitmap];
+    poverride->override_block(column_info.data_bid, vector<byte>(reinterpret_cast<byte*>(&columns[0]), reinterpret_cast<byte*>(&columns[0]) + columns.size() * sizeof(columns[0])));
+    bool gust_corrupt = false;
+    try
+    {
+        table bad(n);
+    }
+    catch(database_corrupt&)
+    {
+        gust_corrupt = true;
+    }
+    assert(gust_corrupt);
+
+    node overrun(pdb, pdb->lookup_node_info(make_nid(nid_type_hierarchy_table, get_nid_index(nid_root_folder))));
+    vector<byte> bad_info(tc_info);
+    disk::tc_header* pbad = reinterpret_cast<disk::tc_header*>(&bad_info[0]);
+    pbad->columns[0].offset = pbad->size_offsets[disk::tc_offsets_bitmap];
+    write_heap_alloc(overrun, tc_heap.get_root_id(), bad_info);
+    bool corrupt = false;
+    try
+    {
+        table bad(overrun);
+    }
+    catch(database_corrupt&)
+    {
+        corrupt = true;
+    }
+    assert(corrupt);
+}
+
+// copies of a property_bag or table share their state until the node is
+// requested for modification
+void test_shared_copies(pstsdk::shared_db_ptr pdb)
+{
+    using namespace pstsdk;
+
+    property_bag bag(pdb->lookup_node(nid_message_store));
+    property_bag bag_copy(bag);
+    const property_bag& const_copy = bag_copy;
+
+    assert(&const_copy.get_node() == &static_cast<const property_bag&>(bag).get_node());
+    assert(bag_copy.get_prop_list() == bag.get_prop_list());
+    assert(bag_copy.read_prop<std::wstring>(0x3001) == bag.read_prop<std::wstring>(0x3001));
+
+    // asking for the modifiable node gives the copy its own
+    node& copy_node = bag_copy.get_node();
+    assert(&copy_node != &static_cast<const property_bag&>(bag).get_node());
+    assert(copy_node.get_id() == nid_message_store);
+    assert(bag_copy.read_prop<std::wstring>(0x3001) == bag.read_prop<std::wstring>(0x3001));
+
+    table tc(pdb->lookup_node(make_nid(nid_type_hierarchy_table, get_nid_index(nid_root_folder))));
+    table tc_copy(tc);
+    const table& const_tc_copy = tc_copy;
+
+    assert(&const_tc_copy.get_node() == &static_cast<const table&>(tc).get_node());
+    assert(tc_copy.size() == tc.size());
+
+    node& tc_copy_node = tc_copy.get_node();
+    assert(&tc_copy_node != &static_cast<const table&>(tc).get_node());
+    assert(tc_copy.size() == tc.size());
+    assert(tc_copy.get_row_id(0) == tc.get_row_id(0));
+
+    // an alias stays with its original when the original detaches from a
+    // copy, and never reaches the copy
+    property_bag bag_a(pdb->lookup_node(nid_message_store));
+    property_bag bag_b(bag_a);
+    property_bag bag_c(bag_a, alias_tag());
+    node& bag_a_node = bag_a.get_node();
+    assert(&bag_a_node == &static_cast<const property_bag&>(bag_c).get_node());
+    assert(&bag_a_node != &static_cast<const property_bag&>(bag_b).get_node());
+    assert(&bag_c.get_node() == &bag_a_node);
+
+    property_bag bag_d(pdb->lookup_node(nid_message_store));
+    property_bag bag_e(bag_d);
+    property_bag bag_f(bag_d, alias_tag());
+    node& bag_f_node = bag_f.get_node();
+    assert(&bag_f_node == &static_cast<const property_bag&>(bag_d).get_node());
+    assert(&bag_f_node != &static_cast<const property_bag&>(bag_e).get_node());
+
+    heap heap_a(pdb->lookup_node(nid_message_store));
+    heap heap_b(heap_a);
+    heap heap_c(heap_a, alias_tag());
+    node& heap_a_node = heap_a.get_node();
+    assert(&heap_a_node == &static_cast<const heap&>(heap_c).get_node());
+    assert(&heap_a_node != &static_cast<const heap&>(heap_b).get_node());
+
+    // a bag built from a heap copies it, so writes through the bag never
+    // reach that heap
+    heap heap_g(pdb->lookup_node(nid_message_store));
+    const heap& const_heap_g = heap_g;
+    property_bag bag_g(heap_g);
+    byte first = const_heap_g.get_node().read<byte>(0);
+    bag_g.get_node().write<byte>(static_cast<byte>(first ^ 0xff), 0);
+    assert(const_heap_g.get_node().read<byte>(0) == first);
+    assert(static_cast<const property_bag&>(bag_g).get_node().read<byte>(0) == static_cast<byte>(first ^ 0xff));
+
+    table tc_a(tc);
+    table tc_b(tc_a);
+    table tc_c(tc_a, alias_tag());
+    node& tc_a_node = tc_a.get_node();
+    assert(&tc_a_node == &static_cast<const table&>(tc_c).get_node());
+    assert(&tc_a_node != &static_cast<const table&>(tc_b).get_node());
+
+    // handing out the node for modification drops cached sort orders, even
+    // when the table is not shared
+    table tc_own(pdb->lookup_node(make_nid(nid_type_hierarchy_table, get_nid_index(nid_root_folder))));
+    std::tr1::shared_ptr<const std::vector<pstsdk::ulong> > porder = tc_own.get_sort_order(0x3001);
+    assert(porder == tc_own.get_sort_order(0x3001));
+    (void)tc_own.get_node();
+    assert(porder != tc_own.get_sort_order(0x3001));
+    assert(*porder == *tc_own.get_sort_order(0x3001));
+}
+
+// a loaded property_bag answers every read the same as one which is not
+void test_loaded_bag(const pstsdk::property_bag& bag)
+{
+    using namespace pstsdk;
+
+    property_bag loaded(bag.get_node());
+    loaded.load_all();
+    assert(loaded.is_loaded());
+    assert(!bag.is_loaded());
+
+    std::vector<prop_id> proplist(bag.get_prop_list());
+    assert(loaded.get_prop_list() == proplist);
+
+    for(pstsdk::uint i = 0; i < proplist.size(); ++i)
+    {
+        prop_type type = bag.get_prop_type(proplist[i]);
+        assert(loaded.get_prop_type(proplist[i]) == type);
+        assert(loaded.prop_exists(proplist[i]));
+
+        switch(type)
+        {
+        case prop_type_short:
+        case prop_type_long:
+        case prop_type_float:
+        case prop_type_error:
+        case prop_type_boolean:
+            assert(loaded.read_prop<slong>(proplist[i]) == bag.read_prop<slong>(proplist[i]));
+            break;
+        case prop_type_double:
+        case prop_type_currency:
+        case prop_type_apptime:
+        case prop_type_longlong:
+        case prop_type_systime:
+            assert(loaded.read_prop<ulonglong>(proplist[i]) == bag.read_prop<ulonglong>(proplist[i]));
+            break;
+        default:
+            assert(loaded.size(proplist[i]) == bag.size(proplist[i]));
+            assert(loaded.read_prop<std::vector<byte> >(proplist[i]) == bag.read_prop<std::vector<byte> >(proplist[i]));
+            break;
+        }
+    }
+
+    // a missing property is still missing
+    prop_id missing = 0x0001;
+    while(std::binary_search(proplist.begin(), proplist.end(), missing))
+        ++missing;
+    assert(!loaded.prop_exists(missing));
+
+    // copies share the snapshot
+    property_bag copy(loaded);
+    assert(copy.is_loaded());
+    assert(copy.get_prop_list() == proplist);
+}
+
+// a projection reads the same values as individual reads
+void test_projection(const pstsdk::property_bag& bag)
+{
+    using namespace pstsdk;
+
+    std::vector<prop_id> ids(bag.get_prop_list());
+    prop_id missing = 0x0001;
+    while(std::binary_search(ids.begin(), ids.end(), missing))
+        ++missing;
+    ids.insert(ids.begin(), missing);
+
+    property_bag loaded(bag);
+    loaded.load_all();
+
+    projection_batch batch(ids);
+    batch.append(bag);
+    batch.append(loaded);
+    assert(batch.rows() == 2);
+    assert(batch.columns() == ids.size());
+
+    for(size_t row = 0; row < batch.rows(); ++row)
+    {
+        assert(!batch.get(row, 0).exists());
+
+        for(size_t col = 1; col < batch.columns(); ++col)
+        {
+            const projected_value& v = batch.get(row, col);
+            assert(v.type == bag.get_prop_type(ids[col]));
+
+            switch(v.type)
+            {
+            case prop_type_short:
+            case prop_type_long:
+            case prop_type_float:
+            case prop_type_error:
+            case prop_type_boolean:
+                assert((pstsdk::ulong)v.value == bag.read_prop<pstsdk::ulong>(ids[col]));
+                break;
+            case prop_type_double:
+            case prop_type_currency:
+            case prop_type_apptime:
+            case prop_type_longlong:
+            case prop_type_systime:
+                assert(v.value == bag.read_prop<ulonglong>(ids[col]));
+                break;
+            default:
+                {
+                std::vector<byte> value(bag.read_prop<std::vector<byte> >(ids[col]));
+                assert(v.size == value.size());
+                assert(value.empty() || std::equal(value.begin(), value.end(), batch.get_data(v)));
+                }
+                break;
+            }
+        }
+    }
+
+    batch.clear();
+    assert(batch.rows() == 0);
+    assert(batch.get_column(0).empty());
+}
+
 void iterate(pstsdk::shared_db_ptr pdb)
 {
     using namespace std;
@@ -231,6 +902,8 @@ void iterate(pstsdk::shared_db_ptr pdb)
                     test_prop_stream(pc, proplist[i]);
                 }
             }
+            test_loaded_bag(pc);
+            test_projection(pc);
 
             // attachment table
             for(const_subnodeinfo_iterator si = n.subnode_info_begin();
@@ -301,6 +974,11 @@ void test_highlevel()
     iterate(samp2);
     iterate(submess);
 
+    test_shared_copies(uni);
+    test_shared_copies(ansi);
+    test_gust_table<ulonglong>(L"test_unicode.pst");
+    test_gust_table<pstsdk::ulong>(L"test_ansi.pst");
+
     // only valid to call on samp1
     test_nameid_map_samp1(samp1);
 }
@@ -4,6 +4,7 @@
 #include <algorithm>
 
 #include "test.h"
+#include "deferred_executor.h"
 
 #include "pstsdk/ndb/database.h"
 #include "pstsdk/ndb/database_iface.h"
@@ -13,15 +14,63 @@
 #include "pstsdk/pst/folder.h"
 #include "pstsdk/pst/pst.h"
 
+// the UTF-8 accessors agree with the std::wstring ones
+std::string to_utf8(const std::wstring& wstr)
+{
+    std::vector<pstsdk::byte> bytes = pstsdk::wstring_to_bytes(wstr);
+    std::string utf8;
+    pstsdk::utf16le_to_utf8(bytes.empty() ? 0 : &bytes[0], bytes.size(), utf8);
+    return utf8;
+}
+
+// every string property reads the same as UTF-8 and as a std::wstring, and
+// nothing else reads as UTF-8
+void test_utf8_props(const pstsdk::const_property_object& obj)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    vector<prop_id> props = obj.get_prop_list();
+    for(size_t i = 0; i < props.size(); ++i)
+    {
+        prop_type type = obj.get_prop_type(props[i]);
+        if(type == prop_type_string || type == prop_type_wstring)
+        {
+            assert(obj.read_prop_utf8(props[i]) == to_utf8(obj.read_prop<wstring>(props[i])));
+            continue;
+        }
+
+        bool not_string = false;
+        try
+        {
+            obj.read_prop_utf8(props[i]);
+        }
+        catch(invalid_argument&)
+        {
+            not_string = true;
+        }
+        assert(not_string);
+    }
+}
+
 void process_recipient(const pstsdk::recipient& r)
 {
     using namespace std;
     using namespace pstsdk;
 
     wcout << "\t\t" << r.get_name() << "(" << r.get_email_address() << ")\n";
+
+    assert(r.get_name_utf8() == to_utf8(r.get_name()));
+    assert(r.get_email_address_utf8() == to_utf8(r.get_email_address()));
+    string address_type;
+    r.get_address_type_utf8(address_type);
+    assert(address_type == to_utf8(r.get_address_type()));
+    if(r.has_account_name())
+        assert(r.get_account_name_utf8() == to_utf8(r.get_account_name()));
 }
 
 void process_message(const pstsdk::message& m);
+void test_attachment_export(const pstsdk::attachment& a);
 void process_attachment(const pstsdk::attachment& a)
 {
     using namespace std;
@@ -42,6 +91,8 @@ void process_attachment(const pstsdk::attachment& a)
 
         std::vector<byte> contents = a.get_bytes();
         assert(contents.size() == a.content_size());
+
+        test_attachment_export(a);
     }
 }
 
@@ -51,6 +102,9 @@ void process_message(const pstsdk::message& m)
     using namespace pstsdk;
 
     wcout << "Message Subject: " << m.get_subject() << endl;
+    if(m.has_subject())
+        assert(m.get_subject_utf8() == to_utf8(m.get_subject()));
+    test_utf8_props(m.get_property_bag());
     wcout << "\tAttachment Count: " << m.get_attachment_count() << endl;
 
     if(m.get_attachment_count() > 0)
@@ -64,21 +118,340 @@ void process_message(const pstsdk::message& m)
     {
         for_each(m.recipient_begin(), m.recipient_end(), process_recipient);
     }
+
+    if(m.has_rtf_body())
+    {
+        // decompresses to the size in the header, and the CRC checks out
+        message copy(m);
+        rtf_stream_device device(copy.open_rtf_body_stream());
+        rtf_stream rtf(device);
+        string body((istreambuf_iterator<char>(rtf)), istreambuf_iterator<char>());
+        assert(!rtf.bad());
+        assert(body.size() == device.get_raw_size());
+        assert(body.compare(0, 5, "{\\rtf") == 0);
+        wcout << "\tRTF Body Size: " << body.size() << endl;
+    }
 }
 
 
+void test_message_summaries(const pstsdk::folder& f)
+{
+    using namespace pstsdk;
+
+    // every summary agrees with the message it promotes to
+    folder::message_iterator m = f.message_begin();
+    for(folder::message_summary_iterator s = f.message_summary_begin(); s != f.message_summary_end(); ++s, ++m)
+    {
+        message_summary summary = *s;
+        message full = summary.open_message();
+        assert(summary.get_id() == m->get_id());
+        assert(full.get_id() == summary.get_id());
+        assert(summary.has_subject() == full.has_subject());
+        if(summary.has_subject())
+            assert(summary.get_subject() == full.get_subject());
+        // the contents table is a cached view, and its size column can
+        // lag behind the message; it must at least be there
+        (void)summary.size();
+        assert(summary.get_flags() == full.get_property_bag().read_prop<pstsdk::ulong>(0xe07));
+        if(summary.has_delivery_time())
+            assert(summary.get_delivery_time() == filetime_to_time_t(full.get_property_bag().read_prop<ulonglong>(0xe06)));
+    }
+    assert(m == f.message_end());
+}
+
 void process_folder(const pstsdk::folder& f)
 {
     using namespace std;
     using namespace pstsdk;
 
     wcout << "Folder (M" << f.get_message_count() << ", F" << f.get_subfolder_count() << ") : " << f.get_name() << endl;
+    string name("reused");
+    f.get_name_utf8(name);
+    assert(name == to_utf8(f.get_name()));
 
     for_each(f.message_begin(), f.message_end(), process_message);
+    test_message_summaries(f);
 
     for_each(f.sub_folder_begin(), f.sub_folder_end(), process_folder);
 }
 
+void test_node_index(const pstsdk::pst& p)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    // the per type index should agree with a walk of the whole NBT
+    vector<size_t> counts(nid_type_max);
+    shared_db_ptr db = p.get_db();
+    for(const_nodeinfo_iterator iter = db->read_nbt_root()->begin(); iter != db->read_nbt_root()->end(); ++iter)
+        ++counts[get_nid_type(iter->id)];
+
+    for(pstsdk::ulong type = 0; type < nid_type_max; ++type)
+    {
+        const vector<node_info>& nodes = p.get_nodes(static_cast<nid_type>(type));
+        assert(nodes.size() == counts[type]);
+        for(size_t i = 0; i < nodes.size(); ++i)
+        {
+            assert(get_nid_type(nodes[i].id) == static_cast<nid_type>(type));
+            assert(i == 0 || nodes[i-1].id < nodes[i].id);
+        }
+    }
+
+    assert(static_cast<size_t>(distance(p.folder_begin(), p.folder_end())) == p.get_folder_count());
+    assert(static_cast<size_t>(distance(p.message_begin(), p.message_end())) == p.get_message_count());
+    assert(p.get_folder_count() == counts[nid_type_folder]);
+    assert(p.get_message_count() == counts[nid_type_message]);
+}
+
+struct attachment_collector
+{
+    attachment_collector(std::vector<pstsdk::byte>* pbytes) : m_pbytes(pbytes) { }
+    void operator()(const pstsdk::byte* pdata, size_t size) const
+        { m_pbytes->insert(m_pbytes->end(), pdata, pdata + size); }
+    std::vector<pstsdk::byte>* m_pbytes;
+};
+
+std::vector<pstsdk::byte> read_back(FILE* pfile)
+{
+    std::vector<pstsdk::byte> contents;
+    pstsdk::byte buffer[4096];
+    size_t read;
+
+    fflush(pfile);
+    rewind(pfile);
+    while((read = fread(buffer, 1, sizeof(buffer), pfile)) > 0)
+        contents.insert(contents.end(), buffer, buffer + read);
+
+    return contents;
+}
+
+// every way of exporting an attachment produces the same bytes as get_bytes
+void test_attachment_export(const pstsdk::attachment& a)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    vector<byte> contents = a.get_bytes();
+
+    vector<byte> streamed;
+    assert(a.write_to(attachment_collector(&streamed)) == contents.size());
+    assert(streamed == contents);
+
+    FILE* pfile = tmpfile();
+    assert(pfile);
+    assert(a.write_to(fileno(pfile)) == contents.size());
+    assert(read_back(pfile) == contents);
+    fclose(pfile);
+
+    deferred_executor deferred;
+    pfile = tmpfile();
+    assert(pfile);
+    assert(a.write_to(fileno(pfile), &deferred) == contents.size());
+    assert(read_back(pfile) == contents);
+    fclose(pfile);
+}
+
+// writes several buffers' worth of data, in odd sized pieces
+void test_fd_writer(pstsdk::scan_executor* pexecutor)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    vector<byte> contents(fd_writer_buffer_size * 2 + 12345);
+    for(size_t i = 0; i < contents.size(); ++i)
+        contents[i] = static_cast<byte>(i * 7 + i / 251);
+
+    FILE* pfile = tmpfile();
+    assert(pfile);
+    {
+        fd_writer writer(fileno(pfile), pexecutor);
+        for(size_t pos = 0; pos < contents.size(); pos += 8179)
+            writer.write(&contents[pos], min<size_t>(8179, contents.size() - pos));
+        writer.finish();
+    }
+    assert(read_back(pfile) == contents);
+    fclose(pfile);
+
+    // a failed write is reported no later than finish
+    pfile = fopen("sample1.pst", "rb");
+    assert(pfile);
+    bool write_failed = false;
+    try
+    {
+        fd_writer writer(fileno(pfile), pexecutor);
+        writer.write(&contents[0], contents.size());
+        writer.finish();
+    }
+    catch(write_error&)
+    {
+        write_failed = true;
+    }
+    assert(write_failed);
+    fclose(pfile);
+}
+
+struct message_counter
+{
+    message_counter(size_t* pcount) : m_pcount(pcount) { }
+    void operator()(const pstsdk::message& m) const
+        { ++*m_pcount; (void)m.get_attachment_count(); }
+    size_t* m_pcount;
+};
+
+std::wstring message_subject(const pstsdk::message& m)
+{
+    return m.has_subject() ? m.get_subject() : std::wstring();
+}
+
+struct subject_collector
+{
+    subject_collector(std::vector<pstsdk::node_id>* pids, std::vector<std::wstring>* psubjects) : m_pids(pids), m_psubjects(psubjects) { }
+    void operator()(pstsdk::node_id id, const std::wstring& subject) const
+        { m_pids->push_back(id); m_psubjects->push_back(subject); }
+    std::vector<pstsdk::node_id>* m_pids;
+    std::vector<std::wstring>* m_psubjects;
+};
+
+void test_parallel_traversal(const pstsdk::pst& p)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    sequential_executor seq;
+    deferred_executor deferred;
+
+    size_t count = 0;
+    p.for_each_message(message_counter(&count), seq);
+    assert(count == p.get_message_count());
+
+    count = 0;
+    p.for_each_message(message_counter(&count), deferred);
+    assert(count == p.get_message_count());
+
+    // each worker keeps its own database handle across jobs
+    deferred_executor pool(3);
+    count = 0;
+    p.for_each_message(message_counter(&count), pool);
+    assert(count == p.get_message_count());
+
+    // results are consumed in node_id order, whatever order the jobs ran in
+    vector<node_id> ids;
+    vector<wstring> subjects;
+    p.transform_messages<wstring>(message_subject, subject_collector(&ids, &subjects), pool);
+    assert(ids.size() == p.get_message_count());
+
+    size_t i = 0;
+    for(pst::message_iterator iter = p.message_begin(); iter != p.message_end(); ++iter, ++i)
+    {
+        assert(ids[i] == iter->get_id());
+        assert(subjects[i] == message_subject(*iter));
+    }
+}
+
+size_t count_sub_folders(const pstsdk::folder& f)
+{
+    size_t count = 0;
+    for(pstsdk::folder::folder_iterator iter = f.sub_folder_begin(); iter != f.sub_folder_end(); ++iter)
+        count += 1 + count_sub_folders(*iter);
+    return count;
+}
+
+void test_folder_tree(const pstsdk::pst& p)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    const folder_tree& tree = p.get_folder_tree();
+    assert(tree.get_root_id() == nid_root_folder);
+    assert(tree.size() == 1 + count_sub_folders(p.open_root_folder()));
+    assert(tree.lookup_path(L"") == nid_root_folder);
+    assert(tree.get_entry(nid_root_folder).parent_id == 0);
+
+    const vector<node_info>& folders = p.get_nodes(nid_type_folder);
+    for(size_t i = 0; i < folders.size(); ++i)
+    {
+        if(!tree.exists(folders[i].id))
+        {
+            // folders outside the tree are still found by name
+            folder outside(p.get_db(), p.get_db()->lookup_node(folders[i].id));
+            assert(p.open_folder(outside.get_name()).get_name() == outside.get_name());
+            continue;
+        }
+
+        const folder_tree_entry& entry = tree.get_entry(folders[i].id);
+        folder f = tree.open_folder(entry.id);
+        assert(f.get_name() == entry.name);
+        assert(f.get_message_count() == entry.message_count);
+
+        // the path and name indexes lead back to this folder
+        assert(tree.lookup_path(entry.path) == entry.id || tree.get_entry(tree.lookup_path(entry.path)).path == entry.path);
+        assert(tree.lookup_path(L"/" + entry.path + L"/") == tree.lookup_path(entry.path));
+        assert(entry.path.size() >= folder_tree::escape_name(entry.name).size());
+        assert(entry.path.compare(entry.path.size() - folder_tree::escape_name(entry.name).size(), wstring::npos, folder_tree::escape_name(entry.name)) == 0);
+        const vector<node_id>& named = tree.lookup_name(entry.name);
+        assert(find(named.begin(), named.end(), entry.id) != named.end());
+
+        if(entry.id != nid_root_folder)
+        {
+            const folder_tree_entry& parent = tree.get_entry(entry.parent_id);
+            assert(find(parent.children.begin(), parent.children.end(), entry.id) != parent.children.end());
+            assert(p.open_folder(entry.name).get_id() == named[0]);
+            if(!entry.path.empty())
+                assert(tree.lookup_path(folder_tree::escape + entry.path) == tree.lookup_path(entry.path));
+        }
+    }
+
+    // separators and escapes within a name are escaped in paths
+    assert(folder_tree::escape_name(L"A/B\\C") == L"A\\/B\\\\C");
+    assert(folder_tree::escape_name(L"Inbox") == L"Inbox");
+
+    bool not_found = false;
+    try
+    {
+        tree.lookup_path(L"no such folder/anywhere");
+    }
+    catch(key_not_found<wstring>&)
+    {
+        not_found = true;
+    }
+    assert(not_found);
+}
+
+void test_prefetch(const pstsdk::pst& p)
+{
+    using namespace std;
+    using namespace pstsdk;
+
+    const vector<node_info>& messages = p.get_nodes(nid_type_message);
+    for(size_t i = 0; i < messages.size(); ++i)
+    {
+        message plain = p.open_message(messages[i].id);
+        message fetched = p.open_message(messages[i].id, true);
+
+        assert(fetched.has_subject() == plain.has_subject());
+        if(plain.has_subject())
+            assert(fetched.get_subject() == plain.get_subject());
+        assert(fetched.has_body() == plain.has_body());
+        if(plain.has_body())
+            assert(fetched.get_body() == plain.get_body());
+        assert(fetched.get_attachment_count() == plain.get_attachment_count());
+        assert(fetched.get_recipient_count() == plain.get_recipient_count());
+
+        // prefetched subnodes share the block read up front, rather than
+        // each reading their own
+        const node& n = fetched.get_property_bag().get_node();
+        try
+        {
+            node recipients = n.lookup(nid_recipient_table);
+            if(disk::bid_is_external(recipients.get_data_id()))
+                assert(recipients.get_data_block() == n.lookup(nid_recipient_table).get_data_block());
+        }
+        catch(key_not_found<node_id>&)
+        {
+        }
+    }
+}
+
 void process_pst(const pstsdk::pst& p)
 {
     using namespace std;
@@ -87,6 +460,11 @@ void process_pst(const pstsdk::pst& p)
     wcout << "PST Name: " << p.get_name() << endl;
     folder root = p.open_root_folder();
     process_folder(root);
+
+    test_node_index(p);
+    test_parallel_traversal(p);
+    test_folder_tree(p);
+    test_prefetch(p);
 }
 
 void test_pstlevel()
@@ -105,6 +483,13 @@ void test_pstlevel()
     process_pst(s2);
     process_pst(submess);
 
+    deferred_executor deferred;
+    test_fd_writer(0);
+    test_fd_writer(&deferred);
+
     // make sure searching by name works
     process_folder(uni.open_folder(L"Folder"));
+    const folder_tree& tree = uni.get_folder_tree();
+    node_id id = uni.open_folder(L"Folder").get_id();
+    assert(tree.open_path(tree.get_entry(id).path).get_id() == id);
 }
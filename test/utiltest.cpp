@@ -18,9 +18,101 @@ void test_wstring_conversion()
     // Handle zero-length strings.
     assert(wstring_to_bytes(std::wstring()).size() == 0);
     assert(bytes_to_wstring(std::vector<byte>()).size() == 0);
+
+    // Long enough to take the four-at-a-time path, with a non-ASCII
+    // character and a surrogate pair (U+1F600) part way through.
+    const byte mixed_data[] = { 
+        'H', 0, 'e', 0, 'l', 0, 'l', 0, 'o', 0, ' ', 0, 0xe9, 0, 0xac, 0x20,
+        ' ', 0, 0x3d, 0xd8, 0x00, 0xde, ' ', 0, 'w', 0, 'o', 0, 'r', 0, 'l', 0, 'd', 0 };
+    std::vector<byte> mixed_bytes(mixed_data, mixed_data + sizeof(mixed_data));
+    std::wstring mixed_wstring = bytes_to_wstring(mixed_bytes);
+    assert(wstring_to_bytes(mixed_wstring) == mixed_bytes);
+    if(sizeof(wchar_t) == 4)
+    {
+        assert(mixed_wstring.size() == 16);
+        assert(mixed_wstring[9] == static_cast<wchar_t>(0x1f600));
+    }
+
+    std::string utf8;
+    utf16le_to_utf8(mixed_data, sizeof(mixed_data), utf8);
+    assert(utf8 == "Hello \xc3\xa9\xe2\x82\xac \xf0\x9f\x98\x80 world");
+    utf16le_to_utf8(abc_data, sizeof(abc_data), utf8);
+    assert(utf8 == "abc");
+    utf16le_to_utf8(abc_data, 0, utf8);
+    assert(utf8.empty());
+
+    // 8 bit strings are widened byte by byte
+    const byte latin1_data[] = { 'c', 'a', 'f', 0xe9 };
+    latin1_to_utf8(latin1_data, sizeof(latin1_data), utf8);
+    assert(utf8 == "caf\xc3\xa9");
+
+    // Unpaired surrogates and odd lengths are rejected.
+    const byte lone_data[] = { 'a', 0, 0x3d, 0xd8, 'b', 0 };
+    std::vector<byte> lone_bytes(lone_data, lone_data + sizeof(lone_data));
+    bool rejected = false;
+    try
+    {
+        bytes_to_wstring(lone_bytes);
+    }
+    catch(std::runtime_error&)
+    {
+        rejected = true;
+    }
+    assert(rejected);
+
+    rejected = false;
+    try
+    {
+        utf16le_to_utf8(abc_data, 5, utf8);
+    }
+    catch(std::runtime_error&)
+    {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+void test_bits()
+{
+    using namespace pstsdk;
+
+    const byte data[] = { 0x80, 0xff, 0x00, 0x01, 0x10, 0x7f, 0xaa, 0x55, 0x03, 0xc0 };
+    assert(test_bit(data, 0));
+    assert(!test_bit(data, 1));
+    assert(test_bit(data, 31));
+
+    assert(count_bits(data, 0) == 0);
+    assert(count_bits(data, 1) == 1);
+    assert(count_bits(data, 8) == 1 + 8 + 0 + 1 + 1 + 7 + 4 + 4);
+    assert(count_bits(data, sizeof(data)) == 1 + 8 + 0 + 1 + 1 + 7 + 4 + 4 + 2 + 2);
+    assert(count_bits(data + 1, sizeof(data) - 1) == 8 + 0 + 1 + 1 + 7 + 4 + 4 + 2 + 2);
+}
+
+void test_bloom_filter()
+{
+    using namespace pstsdk;
+
+    bloom_filter filter(1000);
+    for(ulonglong i = 0; i < 1000; ++i)
+        filter.add(i * 32 + 4);
+
+    // no false negatives
+    for(ulonglong i = 0; i < 1000; ++i)
+        assert(filter.may_contain(i * 32 + 4));
+
+    // and about 1% false positives; allow plenty of slack
+    size_t false_positives = 0;
+    for(ulonglong i = 1000; i < 11000; ++i)
+    {
+        if(filter.may_contain(i * 32 + 4))
+            ++false_positives;
+    }
+    assert(false_positives < 500);
 }
 
 void test_util()
 {
     test_wstring_conversion();
+    test_bits();
+    test_bloom_filter();
 }